@@ -0,0 +1,46 @@
+#pragma once
+
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <glm/glm.hpp>
+
+namespace FRC_Kinect
+{
+	struct boundingBox
+	{
+		glm::vec3 topLeft;
+		glm::vec3 topRight;
+		glm::vec3 bottomLeft;
+		glm::vec3 bottomRight;
+		glm::vec3 center;
+
+		boundingBox(glm::vec3 topLeft, glm::vec3 topRight, glm::vec3 bottomLeft, glm::vec3 bottomRight)
+		{
+			this->topLeft = topLeft;
+			this->topRight = topRight;
+			this->bottomLeft = bottomLeft;
+			this->bottomRight = bottomRight;
+			this->center = glm::vec3((topLeft.x + topRight.x + bottomLeft.x + bottomRight.x) / 4, (topLeft.y + topRight.y + bottomLeft.y + bottomRight.y) / 4, (topLeft.z + topRight.z + bottomLeft.z + bottomRight.z) / 4);
+		}
+
+		boundingBox()
+		{
+			this->topLeft = glm::vec3(0, 0, 0);
+			this->topRight = glm::vec3(0, 0, 0);
+			this->bottomLeft = glm::vec3(0, 0, 0);
+			this->bottomRight = glm::vec3(0, 0, 0);
+			this->center = glm::vec3(0, 0, 0);
+		}
+
+		static boundingBox fromRect(cv::Rect rect)
+		{
+			return boundingBox(glm::vec3(rect.x, rect.y, 0), glm::vec3(rect.x + rect.width, rect.y, 0), glm::vec3(rect.x, rect.y + rect.height, 0), glm::vec3(rect.x + rect.width, rect.y + rect.height, 0));
+		}
+
+		static boundingBox fromCornerPoints(std::vector<cv::Point2f> points)
+		{
+			return boundingBox(glm::vec3(points[0].x, points[0].y, 0), glm::vec3(points[1].x, points[1].y, 0), glm::vec3(points[2].x, points[2].y, 0), glm::vec3(points[3].x, points[3].y, 0));
+		}
+	};
+}
@@ -0,0 +1,495 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+#include "Helpers.hpp"
+#include "Marker.hpp"
+
+namespace FRC_Kinect
+{
+	// mjpeg over http view of the kinect for the driver station, encoded on its own thread and held under a bandwidth budget
+	//   /stream.mjpg    multipart jpeg stream
+	//   /snapshot.jpg   latest encoded frame
+	// either accepts ?view=rgb|depth|overlay to switch what is shown
+	class DashboardStream
+	{
+	public:
+		enum View
+		{
+			RGB = 0,
+			Depth,
+			Overlay
+		};
+
+	private:
+		int port;
+		int listenSocket = -1;
+		std::atomic<bool> running;
+		std::thread serverThread;
+		std::thread encoderThread;
+
+		// latest published frame, replaced whenever the encoder has not picked it up yet
+		std::mutex frameMutex;
+		std::condition_variable frameReady;
+		cv::Mat pendingRgb;
+		cv::Mat pendingDepth;
+		std::vector<Marker> pendingMarkers;
+		bool newFrame = false;
+		std::atomic<int> view;
+
+		std::mutex clientMutex;
+		std::vector<int> clients;
+		std::vector<uint8_t> lastJpeg;
+
+		// rate control
+		std::atomic<int> kbps;
+		float maxFps = 30;
+		float idleFps = 1;
+		std::atomic<float> fps;
+		int quality = 80;
+		int minQuality = 30;
+		int maxQuality = 90;
+		std::vector<float> scales = {1, 0.75f, 0.5f, 0.375f, 0.25f};
+		int scaleIndex = 0;
+		float minFps = 5;
+		float averageFrameSize = 0;
+		float tokens = 0;
+		std::chrono::steady_clock::time_point lastRefill;
+		// every byte written to any viewer, snapshots included, the bucket is charged for all of it
+		std::atomic<uint64_t> bytesSent;
+		uint64_t bytesCharged = 0;
+		std::atomic<int64_t> lastEncodeTime;
+
+		static int64_t now()
+		{
+			return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+
+		bool sendAll(int socket, const void *data, size_t size)
+		{
+			const char *bytes = (const char *)data;
+			while (size > 0)
+			{
+				ssize_t sent = send(socket, bytes, size, MSG_NOSIGNAL);
+				if (sent <= 0)
+				{
+					return false;
+				}
+				bytesSent += sent;
+				bytes += sent;
+				size -= sent;
+			}
+			return true;
+		}
+
+		bool sendString(int socket, std::string text)
+		{
+			return sendAll(socket, text.data(), text.size());
+		}
+
+		void setViewFromRequest(std::string request)
+		{
+			size_t query = request.find("view=");
+			if (query == std::string::npos)
+			{
+				return;
+			}
+			std::string name = request.substr(query + 5, request.find_first_of(" &\r\n", query + 5) - query - 5);
+			if (name == "rgb")
+			{
+				view = RGB;
+			}
+			else if (name == "depth")
+			{
+				view = Depth;
+			}
+			else if (name == "overlay")
+			{
+				view = Overlay;
+			}
+		}
+
+		void serve()
+		{
+			while (running)
+			{
+				pollfd listening = {listenSocket, POLLIN, 0};
+				if (poll(&listening, 1, 100) <= 0)
+				{
+					continue;
+				}
+				int client = accept(listenSocket, nullptr, nullptr);
+				if (client < 0)
+				{
+					continue;
+				}
+				// a stalled viewer only ever holds up the encoder thread for this long
+				timeval timeout = {0, 200000};
+				setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+				setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+				char buffer[1024];
+				ssize_t received = recv(client, buffer, sizeof(buffer) - 1, 0);
+				if (received <= 0)
+				{
+					close(client);
+					continue;
+				}
+				buffer[received] = 0;
+				std::string request(buffer);
+				setViewFromRequest(request);
+
+				if (request.rfind("GET /stream.mjpg", 0) == 0 || request.rfind("GET / ", 0) == 0 || request.rfind("GET /?", 0) == 0)
+				{
+					if (sendString(client, "HTTP/1.0 200 OK\r\nCache-Control: no-cache\r\nConnection: close\r\nContent-Type: multipart/x-mixed-replace; boundary=frame\r\n\r\n"))
+					{
+						std::lock_guard<std::mutex> lock(clientMutex);
+						clients.push_back(client);
+						continue;
+					}
+				}
+				else if (request.rfind("GET /snapshot.jpg", 0) == 0)
+				{
+					std::vector<uint8_t> jpeg;
+					{
+						std::lock_guard<std::mutex> lock(clientMutex);
+						jpeg = lastJpeg;
+					}
+					if (jpeg.size() == 0)
+					{
+						sendString(client, "HTTP/1.0 503 Service Unavailable\r\nConnection: close\r\nContent-Length: 0\r\n\r\n");
+					}
+					else if (sendString(client, "HTTP/1.0 200 OK\r\nConnection: close\r\nContent-Type: image/jpeg\r\nContent-Length: " + std::to_string(jpeg.size()) + "\r\n\r\n"))
+					{
+						sendAll(client, jpeg.data(), jpeg.size());
+					}
+				}
+				else
+				{
+					sendString(client, "HTTP/1.0 404 Not Found\r\nConnection: close\r\nContent-Length: 0\r\n\r\n");
+				}
+				close(client);
+			}
+		}
+
+		cv::Mat compose(cv::Mat rgb, cv::Mat depth, std::vector<Marker> markers)
+		{
+			cv::Mat image;
+			if (view == Depth && !depth.empty())
+			{
+				cv::cvtColor(depth, image, cv::COLOR_RGB2BGR);
+			}
+			else if (!rgb.empty())
+			{
+				cv::cvtColor(rgb, image, cv::COLOR_RGB2BGR);
+			}
+			else
+			{
+				return image;
+			}
+			if (view == Overlay)
+			{
+				for (int i = 0; i < markers.size(); i++)
+				{
+					std::vector<std::vector<cv::Point>> outline = {{cv::Point(markers[i].topLeft.x * image.cols, markers[i].topLeft.y * image.rows),
+																	cv::Point(markers[i].topRight.x * image.cols, markers[i].topRight.y * image.rows),
+																	cv::Point(markers[i].bottomLeft.x * image.cols, markers[i].bottomLeft.y * image.rows),
+																	cv::Point(markers[i].bottomRight.x * image.cols, markers[i].bottomRight.y * image.rows)}};
+					cv::polylines(image, outline, true, cv::Scalar(0, 0, 255), 2);
+					char idText[20];
+					sprintf(idText, "ID:%d", markers[i].id);
+					cv::putText(image, idText, cv::Point(markers[i].center.x * image.cols, markers[i].center.y * image.rows), cv::FONT_HERSHEY_SIMPLEX, 0.6, cv::Scalar(255, 0, 0), 2);
+				}
+			}
+			if (scales[scaleIndex] < 1)
+			{
+				cv::resize(image, image, cv::Size(), scales[scaleIndex], scales[scaleIndex], cv::INTER_AREA);
+			}
+			return image;
+		}
+
+		// steer quality, then resolution, then frame rate so the average frame fits the budget at the current rate
+		void adapt(size_t frameSize)
+		{
+			averageFrameSize = averageFrameSize == 0 ? frameSize : _lerp(averageFrameSize, frameSize, 0.2f);
+			float target = kbps * 1000 / 8.0f / fps;
+			if (averageFrameSize > target)
+			{
+				if (quality > minQuality)
+				{
+					quality = std::max(minQuality, quality - 10);
+				}
+				else if (scaleIndex + 1 < scales.size())
+				{
+					scaleIndex++;
+					quality = maxQuality - 20;
+					averageFrameSize = 0;
+				}
+				else
+				{
+					fps = std::max(minFps, fps * 0.8f);
+				}
+			}
+			else if (averageFrameSize < target * 0.6f)
+			{
+				if (fps < maxFps)
+				{
+					fps = std::min(maxFps, fps * 1.25f);
+				}
+				else if (quality < maxQuality)
+				{
+					quality = std::min(maxQuality, quality + 5);
+				}
+				else if (scaleIndex > 0)
+				{
+					scaleIndex--;
+					quality = minQuality + 20;
+					averageFrameSize = 0;
+				}
+			}
+		}
+
+		void encode()
+		{
+			while (running)
+			{
+				cv::Mat rgb, depth;
+				std::vector<Marker> markers;
+				{
+					std::unique_lock<std::mutex> lock(frameMutex);
+					frameReady.wait_for(lock, std::chrono::milliseconds(100), [this]()
+										{ return newFrame || !running; });
+					if (!newFrame)
+					{
+						continue;
+					}
+					std::swap(rgb, pendingRgb);
+					std::swap(depth, pendingDepth);
+					std::swap(markers, pendingMarkers);
+					newFrame = false;
+				}
+
+				// token bucket holding a quarter second of budget keeps bursts under the cap, the cap is for the whole link
+				// so it pays for what every viewer was sent
+				float bytesPerSecond = kbps * 1000 / 8.0f;
+				uint64_t sent = bytesSent;
+				tokens = std::min(bytesPerSecond / 4, tokens + bytesPerSecond * _millisecondsSince(lastRefill) / 1000) - (sent - bytesCharged);
+				bytesCharged = sent;
+				lastRefill = std::chrono::steady_clock::now();
+				if (tokens < 0)
+				{
+					continue;
+				}
+
+				cv::Mat image = compose(rgb, depth, markers);
+				if (image.empty())
+				{
+					continue;
+				}
+				std::vector<uint8_t> jpeg;
+				cv::imencode(".jpg", image, jpeg, {cv::IMWRITE_JPEG_QUALITY, quality});
+
+				std::vector<int> streaming;
+				{
+					std::lock_guard<std::mutex> lock(clientMutex);
+					lastJpeg = jpeg;
+					streaming = clients;
+				}
+				if (streaming.size() == 0)
+				{
+					continue;
+				}
+				std::string header = "--frame\r\nContent-Type: image/jpeg\r\nContent-Length: " + std::to_string(jpeg.size()) + "\r\n\r\n";
+				std::vector<int> dropped;
+				for (int i = 0; i < streaming.size(); i++)
+				{
+					if (!sendString(streaming[i], header) || !sendAll(streaming[i], jpeg.data(), jpeg.size()) || !sendString(streaming[i], "\r\n"))
+					{
+						dropped.push_back(streaming[i]);
+					}
+				}
+				// each extra viewer costs a whole frame, so viewers push quality, scale and fps down together
+				sent = bytesSent;
+				tokens -= sent - bytesCharged;
+				adapt(sent - bytesCharged);
+				bytesCharged = sent;
+				if (dropped.size() > 0)
+				{
+					std::lock_guard<std::mutex> lock(clientMutex);
+					for (int i = 0; i < dropped.size(); i++)
+					{
+						clients.erase(std::remove(clients.begin(), clients.end(), dropped[i]), clients.end());
+						close(dropped[i]);
+					}
+				}
+			}
+		}
+
+	public:
+		// 1181 is inside the 1180-1190 range fms leaves open for camera streams, 0 picks a free port (see getPort)
+		DashboardStream(int port = 1181, int kbps = 1000)
+		{
+			this->port = port;
+			this->kbps = kbps;
+			this->view = Overlay;
+			this->fps = maxFps;
+			this->running = false;
+			this->lastEncodeTime = 0;
+			this->bytesSent = 0;
+		}
+
+		~DashboardStream()
+		{
+			Stop();
+		}
+
+		bool Start()
+		{
+			if (running)
+			{
+				return true;
+			}
+			listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+			if (listenSocket < 0)
+			{
+				return false;
+			}
+			int reuse = 1;
+			setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+			sockaddr_in address = {};
+			address.sin_family = AF_INET;
+			address.sin_addr.s_addr = htonl(INADDR_ANY);
+			address.sin_port = htons(port);
+			if (bind(listenSocket, (sockaddr *)&address, sizeof(address)) < 0 || listen(listenSocket, 4) < 0)
+			{
+				close(listenSocket);
+				listenSocket = -1;
+				return false;
+			}
+			socklen_t length = sizeof(address);
+			getsockname(listenSocket, (sockaddr *)&address, &length);
+			port = ntohs(address.sin_port);
+			lastRefill = std::chrono::steady_clock::now();
+			running = true;
+			serverThread = std::thread(&DashboardStream::serve, this);
+			encoderThread = std::thread(&DashboardStream::encode, this);
+			return true;
+		}
+
+		void Stop()
+		{
+			if (!running)
+			{
+				return;
+			}
+			running = false;
+			frameReady.notify_all();
+			serverThread.join();
+			encoderThread.join();
+			close(listenSocket);
+			listenSocket = -1;
+			std::lock_guard<std::mutex> lock(clientMutex);
+			for (int i = 0; i < clients.size(); i++)
+			{
+				close(clients[i]);
+			}
+			clients.clear();
+		}
+
+		int getPort()
+		{
+			return port;
+		}
+
+		void setView(View view)
+		{
+			this->view = view;
+		}
+
+		View getView()
+		{
+			return (View)(int)view;
+		}
+
+		void setBandwidth(int kbps)
+		{
+			this->kbps = kbps;
+		}
+
+		int getBandwidth()
+		{
+			return kbps;
+		}
+
+		float getFps()
+		{
+			return fps;
+		}
+
+		uint64_t getBytesSent()
+		{
+			return bytesSent;
+		}
+
+		// hand over the latest frame, returns straight away and drops the frame if the stream does not want one yet
+		// pass an empty mat for a source that has no new frame
+		void Publish(const cv::Mat &rgb, const cv::Mat &depth, const std::vector<Marker> &markers)
+		{
+			// nothing new for this view, keep the interval open for the next real frame
+			bool depthView = view == Depth;
+			if (!running || (depthView ? depth : rgb).empty())
+			{
+				return;
+			}
+			bool streaming;
+			{
+				std::lock_guard<std::mutex> lock(clientMutex);
+				streaming = clients.size() > 0;
+			}
+			// without viewers keep a slow trickle so snapshots stay fresh
+			int64_t interval = 1000000 / (streaming ? fps.load() : idleFps);
+			if (now() - lastEncodeTime < interval)
+			{
+				return;
+			}
+			lastEncodeTime = now();
+
+			cv::Mat rgbCopy, depthCopy;
+			if (!depthView)
+			{
+				rgbCopy = rgb.clone();
+			}
+			else
+			{
+				depthCopy = depth.clone();
+			}
+			{
+				std::lock_guard<std::mutex> lock(frameMutex);
+				pendingRgb = rgbCopy;
+				pendingDepth = depthCopy;
+				pendingMarkers = markers;
+				newFrame = true;
+			}
+			frameReady.notify_one();
+		}
+	};
+}
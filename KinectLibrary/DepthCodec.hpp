@@ -0,0 +1,494 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <algorithm>
+
+namespace FRC_Kinect
+{
+	// lossless codec for 11 bit kinect depth frames
+	//
+	// a frame is split into bands of rows that are coded independently so they can be encoded and decoded on separate threads.
+	// each band is predicted either within the frame (intra: left neighbour on the band's first row, a 1 2 1 weighted average of the
+	// row above after that) or from the same pixel in the previous frame (inter), whichever packs smaller. past the first row every
+	// prediction comes from a finished row, so a whole row decodes at once without a serial dependency along it. residuals are wrapped to 11 bits, zigzagged and bit packed in blocks of 16 with a width byte per block.
+	// bands holding values over 11 bits are stored raw so the codec stays lossless for any input.
+	//
+	// frame layout (little endian):
+	//   "FKDZ" u8 version u8 flags u16 bandRows u16 width u16 height u16 bandCount u16 reserved
+	//   u32 band sizes[bandCount]
+	//   bands: u8 mode, then packed blocks (intra/inter) or u16 pixels (raw)
+	namespace DepthCodec
+	{
+		const uint8_t Version = 2;
+		const uint8_t KeyframeFlag = 1;
+		const int HeaderSize = 16;
+		const int BlockSize = 16;
+		const int ValueBits = 11;
+		const uint16_t ValueMask = (1 << ValueBits) - 1;
+
+		enum BandMode
+		{
+			Intra = 0,
+			Inter = 1,
+			Raw = 2
+		};
+
+		inline void put16(uint8_t *out, uint16_t value)
+		{
+			out[0] = value & 0xFF;
+			out[1] = value >> 8;
+		}
+
+		inline void put32(uint8_t *out, uint32_t value)
+		{
+			put16(out, value & 0xFFFF);
+			put16(out + 2, value >> 16);
+		}
+
+		inline uint16_t get16(const uint8_t *in)
+		{
+			return in[0] | (in[1] << 8);
+		}
+
+		inline uint32_t get32(const uint8_t *in)
+		{
+			return get16(in) | ((uint32_t)get16(in + 2) << 16);
+		}
+
+		// wraps value - prediction to 11 bits and folds the sign into the low bit
+		inline uint16_t zigzag(uint16_t value, uint16_t prediction)
+		{
+			int residual = (value - prediction) & ValueMask;
+			if (residual >= (1 << (ValueBits - 1)))
+			{
+				residual -= 1 << ValueBits;
+			}
+			return (uint16_t)((residual << 1) ^ (residual >> 31));
+		}
+
+		inline uint16_t unzigzag(uint16_t code, uint16_t prediction)
+		{
+			int residual = (code >> 1) ^ -(int)(code & 1);
+			return (prediction + residual) & ValueMask;
+		}
+
+		// intra prediction for pixels 1 .. width - 2 of a row, from the row above
+		inline uint16_t upPrediction(const uint16_t *up, int x)
+		{
+			return (2 * up[x] + up[x - 1] + up[x + 1] + 2) >> 2;
+		}
+
+		inline int bitWidth(uint16_t bits)
+		{
+			int width = 0;
+			while (bits)
+			{
+				width++;
+				bits >>= 1;
+			}
+			return width;
+		}
+
+		// size in bytes of a packed residual stream
+		inline size_t packedSize(const uint16_t *codes, int count)
+		{
+			size_t size = 0;
+			for (int i = 0; i < count; i += BlockSize)
+			{
+				uint16_t bits = 0;
+				for (int j = 0; j < BlockSize; j++)
+				{
+					bits |= codes[i + j];
+				}
+				size += 1 + bitWidth(bits) * BlockSize / 8;
+			}
+			return size;
+		}
+
+		// codes must be padded to a multiple of BlockSize
+		inline void pack(const uint16_t *codes, int count, std::vector<uint8_t> &out)
+		{
+			for (int i = 0; i < count; i += BlockSize)
+			{
+				uint16_t bits = 0;
+				for (int j = 0; j < BlockSize; j++)
+				{
+					bits |= codes[i + j];
+				}
+				int width = bitWidth(bits);
+				out.push_back(width);
+				uint64_t accumulator = 0;
+				int filled = 0;
+				for (int j = 0; j < BlockSize; j++)
+				{
+					accumulator |= (uint64_t)codes[i + j] << filled;
+					filled += width;
+					while (filled >= 8)
+					{
+						out.push_back(accumulator & 0xFF);
+						accumulator >>= 8;
+						filled -= 8;
+					}
+				}
+			}
+		}
+
+		// returns the number of bytes read, 0 if the stream is truncated or malformed
+		inline size_t unpack(const uint8_t *in, size_t size, uint16_t *codes, int count)
+		{
+			size_t read = 0;
+			for (int i = 0; i < count; i += BlockSize)
+			{
+				if (read >= size)
+				{
+					return 0;
+				}
+				int width = in[read++];
+				if (width > ValueBits || read + width * BlockSize / 8 > size)
+				{
+					return 0;
+				}
+				uint16_t mask = (1 << width) - 1;
+				uint64_t accumulator = 0;
+				int filled = 0;
+				for (int j = 0; j < BlockSize; j++)
+				{
+					while (filled < width)
+					{
+						accumulator |= (uint64_t)in[read++] << filled;
+						filled += 8;
+					}
+					codes[i + j] = accumulator & mask;
+					accumulator >>= width;
+					filled -= width;
+				}
+			}
+			return read;
+		}
+
+		// runs work(band) for every band, split over threadcount threads
+		// the threads are started per call, which only pays off on large frames or when a caller is not already keeping cores busy
+		template <typename Work>
+		void forEachBand(int bandCount, int threadcount, Work work)
+		{
+			if (threadcount <= 1 || bandCount <= 1)
+			{
+				for (int band = 0; band < bandCount; band++)
+				{
+					work(band);
+				}
+				return;
+			}
+			std::vector<std::thread> threads;
+			for (int i = 0; i < threadcount; i++)
+			{
+				threads.push_back(std::thread([&, i]()
+											  {
+					for (int band = i * bandCount / threadcount; band < (i + 1) * bandCount / threadcount; band++)
+					{
+						work(band);
+					} }));
+			}
+			for (int i = 0; i < threadcount; i++)
+			{
+				threads[i].join();
+			}
+		}
+	}
+
+	class DepthEncoder
+	{
+	private:
+		int width;
+		int height;
+		int bandRows = 16;
+		int threadcount;
+		int keyframeInterval = 30;
+		int framesSinceKeyframe = 0;
+		std::vector<uint16_t> previous;
+		std::vector<std::vector<uint8_t>> bands;
+
+		void encodeBand(const uint16_t *depth, int band, bool keyframe)
+		{
+			std::vector<uint8_t> &out = bands[band];
+			out.clear();
+			int firstRow = band * bandRows;
+			int rows = std::min(bandRows, height - firstRow);
+			int count = rows * width;
+			int padded = (count + DepthCodec::BlockSize - 1) / DepthCodec::BlockSize * DepthCodec::BlockSize;
+			const uint16_t *current = depth + firstRow * width;
+
+			uint16_t over = 0;
+			for (int i = 0; i < count; i++)
+			{
+				over |= current[i] & ~DepthCodec::ValueMask;
+			}
+			if (over)
+			{
+				out.resize(1 + count * 2);
+				out[0] = DepthCodec::Raw;
+				for (int i = 0; i < count; i++)
+				{
+					DepthCodec::put16(&out[1 + i * 2], current[i]);
+				}
+				return;
+			}
+
+			std::vector<uint16_t> intra(padded, 0);
+			for (int row = 0; row < rows; row++)
+			{
+				const uint16_t *line = current + row * width;
+				uint16_t *codes = &intra[row * width];
+				if (row == 0)
+				{
+					codes[0] = DepthCodec::zigzag(line[0], 0);
+					for (int x = 1; x < width; x++)
+					{
+						codes[x] = DepthCodec::zigzag(line[x], line[x - 1]);
+					}
+				}
+				else
+				{
+					// the end pixels have one upper neighbour
+					const uint16_t *up = line - width;
+					codes[0] = DepthCodec::zigzag(line[0], up[0]);
+					for (int x = 1; x < width - 1; x++)
+					{
+						codes[x] = DepthCodec::zigzag(line[x], DepthCodec::upPrediction(up, x));
+					}
+					codes[width - 1] = DepthCodec::zigzag(line[width - 1], up[width - 1]);
+				}
+			}
+			size_t intraSize = DepthCodec::packedSize(intra.data(), padded);
+
+			if (!keyframe)
+			{
+				std::vector<uint16_t> inter(padded, 0);
+				const uint16_t *reference = previous.data() + firstRow * width;
+				for (int i = 0; i < count; i++)
+				{
+					inter[i] = DepthCodec::zigzag(current[i], reference[i]);
+				}
+				if (DepthCodec::packedSize(inter.data(), padded) < intraSize)
+				{
+					out.push_back(DepthCodec::Inter);
+					DepthCodec::pack(inter.data(), padded, out);
+					return;
+				}
+			}
+			out.push_back(DepthCodec::Intra);
+			DepthCodec::pack(intra.data(), padded, out);
+		}
+
+	public:
+		DepthEncoder(int width = 640, int height = 480, int threadcount = 1)
+		{
+			this->width = width;
+			this->height = height;
+			this->threadcount = threadcount;
+		}
+
+		// frames between keyframes, 1 disables inter frame prediction
+		void setKeyframeInterval(int keyframeInterval)
+		{
+			this->keyframeInterval = keyframeInterval;
+		}
+
+		void setThreadCount(int threadcount)
+		{
+			this->threadcount = threadcount;
+		}
+
+		// force the next frame to be a keyframe
+		void Reset()
+		{
+			previous.clear();
+		}
+
+		std::vector<uint8_t> Encode(const uint16_t *depth)
+		{
+			bool keyframe = previous.size() != width * height || framesSinceKeyframe + 1 >= keyframeInterval;
+			framesSinceKeyframe = keyframe ? 0 : framesSinceKeyframe + 1;
+
+			int bandCount = (height + bandRows - 1) / bandRows;
+			bands.resize(bandCount);
+			DepthCodec::forEachBand(bandCount, threadcount, [&](int band)
+									{ encodeBand(depth, band, keyframe); });
+
+			size_t size = DepthCodec::HeaderSize + bandCount * 4;
+			for (int i = 0; i < bandCount; i++)
+			{
+				size += bands[i].size();
+			}
+			std::vector<uint8_t> data(size);
+			memcpy(&data[0], "FKDZ", 4);
+			data[4] = DepthCodec::Version;
+			data[5] = keyframe ? DepthCodec::KeyframeFlag : 0;
+			DepthCodec::put16(&data[6], bandRows);
+			DepthCodec::put16(&data[8], width);
+			DepthCodec::put16(&data[10], height);
+			DepthCodec::put16(&data[12], bandCount);
+			DepthCodec::put16(&data[14], 0);
+			size_t offset = DepthCodec::HeaderSize + bandCount * 4;
+			for (int i = 0; i < bandCount; i++)
+			{
+				DepthCodec::put32(&data[DepthCodec::HeaderSize + i * 4], bands[i].size());
+				memcpy(&data[offset], bands[i].data(), bands[i].size());
+				offset += bands[i].size();
+			}
+
+			previous.assign(depth, depth + width * height);
+			return data;
+		}
+
+		std::vector<uint8_t> Encode(const std::vector<uint16_t> &depth)
+		{
+			return Encode(depth.data());
+		}
+	};
+
+	class DepthDecoder
+	{
+	private:
+		int threadcount;
+		std::vector<uint16_t> previous;
+
+	public:
+		DepthDecoder(int threadcount = 1)
+		{
+			this->threadcount = threadcount;
+		}
+
+		void setThreadCount(int threadcount)
+		{
+			this->threadcount = threadcount;
+		}
+
+		// returns false if the frame is malformed or is an inter frame without its reference
+		bool Decode(const uint8_t *data, size_t size, std::vector<uint16_t> &depth, int *width = nullptr, int *height = nullptr)
+		{
+			if (size < DepthCodec::HeaderSize || memcmp(data, "FKDZ", 4) != 0 || data[4] != DepthCodec::Version)
+			{
+				return false;
+			}
+			bool keyframe = data[5] & DepthCodec::KeyframeFlag;
+			int bandRows = DepthCodec::get16(&data[6]);
+			int frameWidth = DepthCodec::get16(&data[8]);
+			int frameHeight = DepthCodec::get16(&data[10]);
+			int bandCount = DepthCodec::get16(&data[12]);
+			if (bandRows == 0 || bandCount != (frameHeight + bandRows - 1) / bandRows || size < DepthCodec::HeaderSize + bandCount * 4)
+			{
+				return false;
+			}
+			if (!keyframe && previous.size() != frameWidth * frameHeight)
+			{
+				return false;
+			}
+
+			std::vector<size_t> offsets(bandCount + 1);
+			offsets[0] = DepthCodec::HeaderSize + bandCount * 4;
+			for (int i = 0; i < bandCount; i++)
+			{
+				offsets[i + 1] = offsets[i] + DepthCodec::get32(&data[DepthCodec::HeaderSize + i * 4]);
+			}
+			if (offsets[bandCount] > size)
+			{
+				return false;
+			}
+
+			depth.resize(frameWidth * frameHeight);
+			std::vector<uint8_t> failed(bandCount, 0);
+			DepthCodec::forEachBand(bandCount, threadcount, [&](int band)
+									{
+				const uint8_t *in = data + offsets[band];
+				size_t bandSize = offsets[band + 1] - offsets[band];
+				int firstRow = band * bandRows;
+				int rows = std::min(bandRows, frameHeight - firstRow);
+				int count = rows * frameWidth;
+				int padded = (count + DepthCodec::BlockSize - 1) / DepthCodec::BlockSize * DepthCodec::BlockSize;
+				uint16_t *current = depth.data() + firstRow * frameWidth;
+				if (bandSize < 1)
+				{
+					failed[band] = 1;
+					return;
+				}
+				if (in[0] == DepthCodec::Raw)
+				{
+					if (bandSize < 1 + count * 2)
+					{
+						failed[band] = 1;
+						return;
+					}
+					for (int i = 0; i < count; i++)
+					{
+						current[i] = DepthCodec::get16(&in[1 + i * 2]);
+					}
+					return;
+				}
+				std::vector<uint16_t> codes(padded);
+				if ((in[0] != DepthCodec::Intra && in[0] != DepthCodec::Inter) || (in[0] == DepthCodec::Inter && keyframe) || DepthCodec::unpack(in + 1, bandSize - 1, codes.data(), padded) == 0)
+				{
+					failed[band] = 1;
+					return;
+				}
+				if (in[0] == DepthCodec::Inter)
+				{
+					const uint16_t *reference = previous.data() + firstRow * frameWidth;
+					for (int i = 0; i < count; i++)
+					{
+						current[i] = DepthCodec::unzigzag(codes[i], reference[i]);
+					}
+					return;
+				}
+				for (int row = 0; row < rows; row++)
+				{
+					uint16_t *line = current + row * frameWidth;
+					const uint16_t *lineCodes = &codes[row * frameWidth];
+					if (row == 0)
+					{
+						line[0] = DepthCodec::unzigzag(lineCodes[0], 0);
+						for (int x = 1; x < frameWidth; x++)
+						{
+							line[x] = DepthCodec::unzigzag(lineCodes[x], line[x - 1]);
+						}
+					}
+					else
+					{
+						const uint16_t *up = line - frameWidth;
+						line[0] = DepthCodec::unzigzag(lineCodes[0], up[0]);
+						for (int x = 1; x < frameWidth - 1; x++)
+						{
+							line[x] = DepthCodec::unzigzag(lineCodes[x], DepthCodec::upPrediction(up, x));
+						}
+						line[frameWidth - 1] = DepthCodec::unzigzag(lineCodes[frameWidth - 1], up[frameWidth - 1]);
+					}
+				} });
+
+			for (int i = 0; i < bandCount; i++)
+			{
+				if (failed[i])
+				{
+					return false;
+				}
+			}
+			previous = depth;
+			if (width)
+			{
+				*width = frameWidth;
+			}
+			if (height)
+			{
+				*height = frameHeight;
+			}
+			return true;
+		}
+
+		bool Decode(const std::vector<uint8_t> &data, std::vector<uint16_t> &depth, int *width = nullptr, int *height = nullptr)
+		{
+			return Decode(data.data(), data.size(), depth, width, height);
+		}
+	};
+}
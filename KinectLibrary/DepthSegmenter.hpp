@@ -0,0 +1,492 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <random>
+
+#include <glm/glm.hpp>
+
+#include "BoundingBox.hpp"
+#include "WorkerPool.hpp"
+
+namespace FRC_Kinect
+{
+	// something standing above the floor, found by depth segmentation
+	struct Blob : public boundingBox
+	{
+		// meters in the depth camera frame, x right, y down, z forward
+		glm::vec3 centroid;
+		glm::vec3 minimum;
+		glm::vec3 maximum;
+		int pixelCount;
+
+		Blob() : boundingBox()
+		{
+			this->pixelCount = 0;
+		}
+	};
+
+	// removes the floor from a depth frame and splits what is left into connected blobs
+	class DepthSegmenter
+	{
+	private:
+		int width;
+		int height;
+		int tileSize = 64;
+
+		// depth camera intrinsics
+		float fx = 594.21f;
+		float fy = 591.04f;
+		float cx = 339.5f;
+		float cy = 242.7f;
+		std::vector<float> rawToMeters;
+
+		float maxRange = 4.0f;
+		// anything closer to the floor than this is floor
+		float floorThreshold = 0.04f;
+		// neighbours further apart than jumpBase + jumpScale * z are not connected
+		float jumpBase = 0.03f;
+		float jumpScale = 0.03f;
+		int minPixels = 200;
+
+		// floor plane n.p + d = 0 with the camera on the positive side
+		bool hasFloor = false;
+		glm::vec3 floorNormal;
+		float floorDistance = 0;
+		float floorSmoothing = 0.2f;
+		// fraction of the sampled lower image that must stay on the plane for it to keep being tracked
+		float floorMinInliers = 0.2f;
+
+		std::vector<glm::vec3> points;
+		std::vector<uint8_t> foreground;
+		std::vector<int> parent;
+
+		glm::vec3 toPoint(int x, int y, float z)
+		{
+			return glm::vec3((x - cx) * z / fx, (y - cy) * z / fy, z);
+		}
+
+		int find(int i)
+		{
+			while (parent[i] != i)
+			{
+				parent[i] = parent[parent[i]];
+				i = parent[i];
+			}
+			return i;
+		}
+
+		// read only find, safe to run from many threads once all unions are done
+		int root(int i)
+		{
+			while (parent[i] != i)
+			{
+				i = parent[i];
+			}
+			return i;
+		}
+
+		void unite(int a, int b)
+		{
+			a = find(a);
+			b = find(b);
+			// the smaller index wins so labels do not depend on merge order
+			if (a < b)
+			{
+				parent[b] = a;
+			}
+			else if (b < a)
+			{
+				parent[a] = b;
+			}
+		}
+
+		bool connected(int a, int b)
+		{
+			if (!foreground[a] || !foreground[b])
+			{
+				return false;
+			}
+			float z = std::min(points[a].z, points[b].z);
+			return std::abs(points[a].z - points[b].z) < jumpBase + jumpScale * z;
+		}
+
+		// least squares fit of y = a x + b z + c, the floor is never vertical in the camera frame
+		bool fitPlane(const std::vector<glm::vec3> &samples, glm::vec3 &normal, float &distance)
+		{
+			if (samples.size() < 3)
+			{
+				return false;
+			}
+			double xx = 0, xz = 0, zz = 0, x = 0, z = 0, n = samples.size(), xy = 0, zy = 0, y = 0;
+			for (int i = 0; i < samples.size(); i++)
+			{
+				xx += samples[i].x * samples[i].x;
+				xz += samples[i].x * samples[i].z;
+				zz += samples[i].z * samples[i].z;
+				x += samples[i].x;
+				z += samples[i].z;
+				xy += samples[i].x * samples[i].y;
+				zy += samples[i].z * samples[i].y;
+				y += samples[i].y;
+			}
+			// cramer's rule on the 3x3 normal equations
+			double det = xx * (zz * n - z * z) - xz * (xz * n - z * x) + x * (xz * z - zz * x);
+			if (std::abs(det) < 1e-9)
+			{
+				return false;
+			}
+			double a = (xy * (zz * n - z * z) - xz * (zy * n - z * y) + x * (zy * z - zz * y)) / det;
+			double b = (xx * (zy * n - y * z) - xy * (xz * n - z * x) + x * (xz * y - zy * x)) / det;
+			double c = (xx * (zz * y - z * zy) - xz * (xz * y - x * zy) + xy * (xz * z - zz * x)) / det;
+			// a x - y + b z + c = 0
+			float length = std::sqrt(a * a + 1 + b * b);
+			normal = glm::vec3(a / length, -1 / length, b / length);
+			distance = c / length;
+			if (distance < 0)
+			{
+				normal = normal * -1;
+				distance = -distance;
+			}
+			return true;
+		}
+
+		float floorOffset(glm::vec3 point)
+		{
+			return floorNormal.x * point.x + floorNormal.y * point.y + floorNormal.z * point.z + floorDistance;
+		}
+
+		// points from the lower part of the image, where the floor usually is
+		std::vector<glm::vec3> floorSamples()
+		{
+			std::vector<glm::vec3> samples;
+			for (int y = height / 2; y < height; y += 4)
+			{
+				for (int x = 0; x < width; x += 4)
+				{
+					if (points[y * width + x].z > 0)
+					{
+						samples.push_back(points[y * width + x]);
+					}
+				}
+			}
+			return samples;
+		}
+
+		// ransac over the lower image for the first fit or after the floor was lost
+		void findFloor(const std::vector<glm::vec3> &samples)
+		{
+			if (samples.size() < 3)
+			{
+				return;
+			}
+			std::mt19937 rng(1);
+			int bestInliers = 0;
+			glm::vec3 bestNormal;
+			float bestDistance = 0;
+			for (int iteration = 0; iteration < 100; iteration++)
+			{
+				glm::vec3 a = samples[rng() % samples.size()];
+				glm::vec3 b = samples[rng() % samples.size()];
+				glm::vec3 c = samples[rng() % samples.size()];
+				glm::vec3 normal = glm::cross(b - a, c - a);
+				float length = std::sqrt(glm::dot(normal, normal));
+				if (length < 1e-6f)
+				{
+					continue;
+				}
+				normal = normal / length;
+				// the floor faces up, within about 35 degrees of the camera's vertical
+				if (std::abs(normal.y) < 0.8f)
+				{
+					continue;
+				}
+				float distance = -glm::dot(normal, a);
+				int inliers = 0;
+				for (int i = 0; i < samples.size(); i += 4)
+				{
+					if (std::abs(glm::dot(normal, samples[i]) + distance) < floorThreshold)
+					{
+						inliers++;
+					}
+				}
+				if (inliers > bestInliers)
+				{
+					bestInliers = inliers;
+					bestNormal = normal;
+					bestDistance = distance;
+				}
+			}
+			if (bestInliers < samples.size() / 4 * floorMinInliers)
+			{
+				return;
+			}
+			std::vector<glm::vec3> inliers;
+			for (int i = 0; i < samples.size(); i++)
+			{
+				if (std::abs(glm::dot(bestNormal, samples[i]) + bestDistance) < floorThreshold)
+				{
+					inliers.push_back(samples[i]);
+				}
+			}
+			hasFloor = fitPlane(inliers, floorNormal, floorDistance);
+		}
+
+		// refit from the points near the current plane and blend it in, drop the floor if too few points still agree
+		void trackFloor(const std::vector<glm::vec3> &samples)
+		{
+			std::vector<glm::vec3> inliers;
+			for (int i = 0; i < samples.size(); i++)
+			{
+				if (std::abs(floorOffset(samples[i])) < floorThreshold * 2)
+				{
+					inliers.push_back(samples[i]);
+				}
+			}
+			glm::vec3 normal;
+			float distance;
+			if (inliers.size() < samples.size() * floorMinInliers || !fitPlane(inliers, normal, distance))
+			{
+				hasFloor = false;
+				return;
+			}
+			floorNormal = floorNormal + (normal - floorNormal) * floorSmoothing;
+			floorNormal = floorNormal / std::sqrt(glm::dot(floorNormal, floorNormal));
+			floorDistance += (distance - floorDistance) * floorSmoothing;
+		}
+
+	public:
+		DepthSegmenter(int width = 640, int height = 480)
+		{
+			this->width = width;
+			this->height = height;
+			points.resize(width * height);
+			foreground.resize(width * height);
+			parent.resize(width * height);
+			rawToMeters.resize(2048);
+			for (int raw = 0; raw < 2048; raw++)
+			{
+				// 2047 is no reading, the rest follows the usual kinect disparity fit
+				float denominator = raw * -0.0030711016f + 3.3309495161f;
+				rawToMeters[raw] = raw < 2047 && denominator > 0 ? 1.0f / denominator : 0;
+			}
+		}
+
+		void setIntrinsics(float fx, float fy, float cx, float cy)
+		{
+			this->fx = fx;
+			this->fy = fy;
+			this->cx = cx;
+			this->cy = cy;
+		}
+
+		void setMaxRange(float maxRange)
+		{
+			this->maxRange = maxRange;
+		}
+
+		void setMinPixels(int minPixels)
+		{
+			this->minPixels = minPixels;
+		}
+
+		bool hasFloorPlane()
+		{
+			return hasFloor;
+		}
+
+		glm::vec3 getFloorNormal()
+		{
+			return floorNormal;
+		}
+
+		float getFloorDistance()
+		{
+			return floorDistance;
+		}
+
+		// forget the floor so the next frame fits it again, for when the camera is tilted
+		void ResetFloor()
+		{
+			hasFloor = false;
+		}
+
+		std::vector<Blob> Segment(const std::vector<uint16_t> &depth)
+		{
+			WorkerPool &pool = SharedWorkerPool();
+
+			// depth to points
+			pool.parallelFor(height, [&](int y)
+							 {
+				for (int x = 0; x < width; x++)
+				{
+					float z = rawToMeters[depth[y * width + x] & 2047];
+					points[y * width + x] = z > 0 && z < maxRange ? toPoint(x, y, z) : glm::vec3(0, 0, 0);
+				} });
+
+			std::vector<glm::vec3> samples = floorSamples();
+			if (hasFloor)
+			{
+				trackFloor(samples);
+			}
+			if (!hasFloor)
+			{
+				findFloor(samples);
+			}
+
+			// everything with a reading that is not floor, then label each tile on its own
+			int tilesX = (width + tileSize - 1) / tileSize;
+			int tilesY = (height + tileSize - 1) / tileSize;
+			pool.parallelFor(tilesX * tilesY, [&](int tile)
+							 {
+				int left = tile % tilesX * tileSize;
+				int top = tile / tilesX * tileSize;
+				int right = std::min(left + tileSize, width);
+				int bottom = std::min(top + tileSize, height);
+				for (int y = top; y < bottom; y++)
+				{
+					for (int x = left; x < right; x++)
+					{
+						int i = y * width + x;
+						foreground[i] = points[i].z > 0 && (!hasFloor || floorOffset(points[i]) > floorThreshold);
+						parent[i] = i;
+						if (x > left && connected(i, i - 1))
+						{
+							unite(i, i - 1);
+						}
+						if (y > top && connected(i, i - width))
+						{
+							unite(i, i - width);
+						}
+					}
+				} });
+
+			// stitch the tiles together along their borders
+			for (int x = tileSize; x < width; x += tileSize)
+			{
+				for (int y = 0; y < height; y++)
+				{
+					if (connected(y * width + x, y * width + x - 1))
+					{
+						unite(y * width + x, y * width + x - 1);
+					}
+				}
+			}
+			for (int y = tileSize; y < height; y += tileSize)
+			{
+				for (int x = 0; x < width; x++)
+				{
+					if (connected(y * width + x, (y - 1) * width + x))
+					{
+						unite(y * width + x, (y - 1) * width + x);
+					}
+				}
+			}
+
+			// accumulate per label in row bands, then combine the bands
+			struct Accumulator
+			{
+				glm::vec3 sum;
+				glm::vec3 minimum;
+				glm::vec3 maximum;
+				int left, top, right, bottom;
+				int count = 0;
+			};
+			int bands = pool.getThreadCount() * 2;
+			std::vector<std::map<int, Accumulator>> bandStats(bands);
+			pool.parallelFor(bands, [&](int band)
+							 {
+				std::map<int, Accumulator> &stats = bandStats[band];
+				// runs of pixels mostly share a label, only look it up again when it changes
+				int lastLabel = -1;
+				Accumulator *last = nullptr;
+				for (int y = band * height / bands; y < (band + 1) * height / bands; y++)
+				{
+					for (int x = 0; x < width; x++)
+					{
+						int i = y * width + x;
+						if (!foreground[i])
+						{
+							continue;
+						}
+						int label = root(i);
+						if (label != lastLabel)
+						{
+							last = &stats[label];
+							lastLabel = label;
+						}
+						Accumulator &blob = *last;
+						glm::vec3 point = points[i];
+						if (blob.count == 0)
+						{
+							blob.sum = glm::vec3(0, 0, 0);
+							blob.minimum = point;
+							blob.maximum = point;
+							blob.left = blob.right = x;
+							blob.top = blob.bottom = y;
+						}
+						blob.sum = blob.sum + point;
+						blob.minimum = glm::vec3(std::min(blob.minimum.x, point.x), std::min(blob.minimum.y, point.y), std::min(blob.minimum.z, point.z));
+						blob.maximum = glm::vec3(std::max(blob.maximum.x, point.x), std::max(blob.maximum.y, point.y), std::max(blob.maximum.z, point.z));
+						blob.left = std::min(blob.left, x);
+						blob.right = std::max(blob.right, x);
+						blob.top = std::min(blob.top, y);
+						blob.bottom = std::max(blob.bottom, y);
+						blob.count++;
+					}
+				} });
+
+			std::map<int, Accumulator> stats = bandStats[0];
+			for (int band = 1; band < bands; band++)
+			{
+				for (std::map<int, Accumulator>::iterator it = bandStats[band].begin(); it != bandStats[band].end(); it++)
+				{
+					Accumulator &blob = stats[it->first];
+					const Accumulator &part = it->second;
+					if (blob.count == 0)
+					{
+						blob = part;
+						continue;
+					}
+					blob.sum = blob.sum + part.sum;
+					blob.minimum = glm::vec3(std::min(blob.minimum.x, part.minimum.x), std::min(blob.minimum.y, part.minimum.y), std::min(blob.minimum.z, part.minimum.z));
+					blob.maximum = glm::vec3(std::max(blob.maximum.x, part.maximum.x), std::max(blob.maximum.y, part.maximum.y), std::max(blob.maximum.z, part.maximum.z));
+					blob.left = std::min(blob.left, part.left);
+					blob.right = std::max(blob.right, part.right);
+					blob.top = std::min(blob.top, part.top);
+					blob.bottom = std::max(blob.bottom, part.bottom);
+					blob.count += part.count;
+				}
+			}
+
+			std::vector<Blob> blobs;
+			for (std::map<int, Accumulator>::iterator it = stats.begin(); it != stats.end(); it++)
+			{
+				const Accumulator &blob = it->second;
+				if (blob.count < minPixels)
+				{
+					continue;
+				}
+				Blob result;
+				result.centroid = blob.sum / (float)blob.count;
+				result.minimum = blob.minimum;
+				result.maximum = blob.maximum;
+				result.pixelCount = blob.count;
+				// normalized image box like markers, z is the centroid distance
+				float left = blob.left / (float)width;
+				float right = (blob.right + 1) / (float)width;
+				float top = blob.top / (float)height;
+				float bottom = (blob.bottom + 1) / (float)height;
+				(boundingBox &)result = boundingBox(glm::vec3(left, top, result.centroid.z), glm::vec3(right, top, result.centroid.z), glm::vec3(left, bottom, result.centroid.z), glm::vec3(right, bottom, result.centroid.z));
+				blobs.push_back(result);
+			}
+			std::sort(blobs.begin(), blobs.end(), [](const Blob &a, const Blob &b)
+					  { return a.pixelCount > b.pixelCount; });
+			return blobs;
+		}
+	};
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <chrono>
+
+namespace FRC_Kinect
+{
+	inline float _lerp(float a, float b, float t)
+	{
+		return a + (b - a) * t;
+	}
+
+	inline float _map(float value, float istart, float istop, float ostart, float ostop)
+	{
+		return ostart + (ostop - ostart) * ((value - istart) / (istop - istart));
+	}
+
+	// milliseconds elapsed since start
+	inline float _millisecondsSince(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+}
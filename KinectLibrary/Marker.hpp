@@ -0,0 +1,66 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include <opencv2/core.hpp>
+#include <glm/glm.hpp>
+
+#include "Helpers.hpp"
+#include "BoundingBox.hpp"
+
+namespace FRC_Kinect
+{
+	struct Marker : public boundingBox
+	{
+		int id;
+		// dictionary the marker was found in, -1 if unknown
+		int dictionary;
+
+		Marker(glm::vec3 topLeft, glm::vec3 topRight, glm::vec3 bottomLeft, glm::vec3 bottomRight, int id) : boundingBox(topLeft, topRight, bottomLeft, bottomRight)
+		{
+			this->id = id;
+			this->dictionary = -1;
+		}
+
+		Marker() : boundingBox()
+		{
+			this->id = -1;
+			this->dictionary = -1;
+		}
+
+		static Marker fromCornerPoints(std::vector<cv::Point2f> points, int id, int width, int height)
+		{
+			return Marker(glm::vec3(points[0].x / (float)width, points[0].y / (float)height, 0), glm::vec3(points[1].x / (float)width, points[1].y / (float)height, 0), glm::vec3(points[2].x / (float)width, points[2].y / (float)height, 0), glm::vec3(points[3].x / (float)width, points[3].y / (float)height, 0), id);
+		}
+
+		static Marker fromRect(cv::Rect rect, int id, int width, int height)
+		{
+			return Marker(glm::vec3(rect.x / (float)width, rect.y / (float)height, 0), glm::vec3((rect.x + rect.width) / (float)width, rect.y / (float)height, 0), glm::vec3(rect.x / (float)width, (rect.y + rect.height) / (float)height, 0), glm::vec3((rect.x + rect.width) / (float)width, (rect.y + rect.height) / (float)height, 0), id);
+		}
+
+		void DetrmineDepth(std::vector<uint16_t> depth, int width, int height)
+		{
+			// get the corners and center from normalized coordinates
+			glm::vec3 topLeft = glm::vec3(_map(this->topLeft.x, 0, 1, 0, width), _map(this->topLeft.y, 0, 1, 0, height), 0);
+			glm::vec3 topRight = glm::vec3(_map(this->topRight.x, 0, 1, 0, width), _map(this->topRight.y, 0, 1, 0, height), 0);
+			glm::vec3 bottomLeft = glm::vec3(_map(this->bottomLeft.x, 0, 1, 0, width), _map(this->bottomLeft.y, 0, 1, 0, height), 0);
+			glm::vec3 bottomRight = glm::vec3(_map(this->bottomRight.x, 0, 1, 0, width), _map(this->bottomRight.y, 0, 1, 0, height), 0);
+			glm::vec3 center = glm::vec3((topLeft.x + topRight.x + bottomLeft.x + bottomRight.x) / 4, (topLeft.y + topRight.y + bottomLeft.y + bottomRight.y) / 4, 0);
+
+			// get the depth data
+			float depthTopLeft = _map(depth[(int)topLeft.y * width + (int)topLeft.x], 0, 2048, 0, 1);
+			float depthTopRight = _map(depth[(int)topRight.y * width + (int)topRight.x], 0, 2048, 0, 1);
+			float depthBottomLeft = _map(depth[(int)bottomLeft.y * width + (int)bottomLeft.x], 0, 2048, 0, 1);
+			float depthBottomRight = _map(depth[(int)bottomRight.y * width + (int)bottomRight.x], 0, 2048, 0, 1);
+			float depthCenter = _map(depth[(int)center.y * width + (int)center.x], 0, 2048, 0, 1);
+
+			// set the depth data
+			this->topLeft.z = depthTopLeft;
+			this->topRight.z = depthTopRight;
+			this->bottomLeft.z = depthBottomLeft;
+			this->bottomRight.z = depthBottomRight;
+			this->center.z = depthCenter;
+		}
+	};
+}
@@ -0,0 +1,214 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include <cstring>
+
+#include "DepthCodec.hpp"
+
+namespace FRC_Kinect
+{
+	// recorded or generated kinect frames that can be fed back through detection without a sensor
+	//
+	// file layout (little endian):
+	//   "FKRP" u32 version u16 width u16 height u32 reserved f32 fx fy cx cy (depth intrinsics)
+	//   frames: u64 sequence u64 timestamp (ns) u8 rgb encoding u8 reserved u16 marker count u32 rgb size u32 depth size
+	//           rgb bytes, depth codec frame, ground truth markers
+	//   an rgb size of 0 marks a depth only frame, as written by the live --depth-log
+	namespace Replay
+	{
+		const uint32_t Version = 3;
+
+		enum RgbEncoding
+		{
+			// 8 bit rgb rows, as the kinect delivers them
+			RawRgb = 0,
+			// png of the rgb image, decode with cv::imdecode and convert bgr back to rgb
+			Png = 1
+		};
+
+		// depth camera intrinsics in pixels, defaults are the kinect's own depth camera
+		struct Intrinsics
+		{
+			float fx = 594.21f;
+			float fy = 591.04f;
+			float cx = 339.5f;
+			float cy = 242.7f;
+		};
+
+		enum TruthFlags
+		{
+			// the whole marker is inside the image and nothing nearer covers it, only these count towards recall
+			TruthVisible = 1
+		};
+
+		// where a marker really was, for checking detection against
+		struct TruthMarker
+		{
+			int32_t id;
+			int16_t dictionary;
+			uint16_t flags;
+			// pixel corners in detector order: top left, top right, bottom right, bottom left
+			float corners[8];
+			// marker pose in the rgb camera frame, rodrigues rotation and translation in meters
+			float rotation[3];
+			float translation[3];
+		};
+
+		static_assert(sizeof(TruthMarker) == 64, "replay truth markers must stay 64 bytes");
+	}
+
+	struct ReplayFrame
+	{
+		uint64_t sequence = 0;
+		uint64_t timestamp = 0;
+		uint8_t rgbEncoding = Replay::RawRgb;
+		std::vector<uint8_t> rgb;
+		std::vector<uint16_t> depth;
+		std::vector<Replay::TruthMarker> truth;
+	};
+
+	class ReplayWriter
+	{
+	private:
+		std::ofstream file;
+		int width;
+		int height;
+		int threadcount;
+		DepthEncoder encoder;
+
+		template <typename T>
+		void write(const T &value)
+		{
+			file.write((const char *)&value, sizeof(T));
+		}
+
+	public:
+		ReplayWriter(int threadcount = 1)
+		{
+			this->threadcount = threadcount;
+		}
+
+		bool Open(std::string path, int width = 640, int height = 480, Replay::Intrinsics intrinsics = Replay::Intrinsics())
+		{
+			file.open(path, std::ios::binary | std::ios::trunc);
+			if (!file.is_open())
+			{
+				return false;
+			}
+			this->width = width;
+			this->height = height;
+			encoder = DepthEncoder(width, height, threadcount);
+			file.write("FKRP", 4);
+			write(Replay::Version);
+			write((uint16_t)width);
+			write((uint16_t)height);
+			write((uint32_t)0);
+			write(intrinsics.fx);
+			write(intrinsics.fy);
+			write(intrinsics.cx);
+			write(intrinsics.cy);
+			return file.good();
+		}
+
+		// frames have to be written in order, depth is coded against the previous frame
+		bool WriteFrame(const ReplayFrame &frame)
+		{
+			return WriteFrame(frame, encoder.Encode(frame.depth.data()));
+		}
+
+		// frame.depth is ignored, depth is a depth codec frame already coded in order against the previous one
+		bool WriteFrame(const ReplayFrame &frame, const std::vector<uint8_t> &depth)
+		{
+			write(frame.sequence);
+			write(frame.timestamp);
+			write(frame.rgbEncoding);
+			write((uint8_t)0);
+			write((uint16_t)frame.truth.size());
+			write((uint32_t)frame.rgb.size());
+			write((uint32_t)depth.size());
+			file.write((const char *)frame.rgb.data(), frame.rgb.size());
+			file.write((const char *)depth.data(), depth.size());
+			file.write((const char *)frame.truth.data(), frame.truth.size() * sizeof(Replay::TruthMarker));
+			return file.good();
+		}
+
+		void Close()
+		{
+			file.close();
+		}
+	};
+
+	class ReplayReader
+	{
+	private:
+		std::ifstream file;
+		int width = 0;
+		int height = 0;
+		Replay::Intrinsics intrinsics;
+		DepthDecoder decoder;
+
+		template <typename T>
+		bool read(T &value)
+		{
+			return (bool)file.read((char *)&value, sizeof(T));
+		}
+
+	public:
+		ReplayReader(int threadcount = 1) : decoder(threadcount)
+		{
+		}
+
+		bool Open(std::string path)
+		{
+			file.open(path, std::ios::binary);
+			char magic[4];
+			uint32_t version, reserved;
+			uint16_t frameWidth, frameHeight;
+			if (!file.read(magic, 4) || memcmp(magic, "FKRP", 4) != 0 || !read(version) || version != Replay::Version || !read(frameWidth) || !read(frameHeight) || !read(reserved) || !read(intrinsics.fx) || !read(intrinsics.fy) || !read(intrinsics.cx) || !read(intrinsics.cy))
+			{
+				return false;
+			}
+			width = frameWidth;
+			height = frameHeight;
+			return true;
+		}
+
+		int getWidth()
+		{
+			return width;
+		}
+
+		int getHeight()
+		{
+			return height;
+		}
+
+		Replay::Intrinsics getIntrinsics()
+		{
+			return intrinsics;
+		}
+
+		// false at the end of the file or on a damaged frame
+		bool ReadFrame(ReplayFrame &frame)
+		{
+			uint8_t reserved;
+			uint16_t markerCount;
+			uint32_t rgbSize, depthSize;
+			if (!read(frame.sequence) || !read(frame.timestamp) || !read(frame.rgbEncoding) || !read(reserved) || !read(markerCount) || !read(rgbSize) || !read(depthSize))
+			{
+				return false;
+			}
+			frame.rgb.resize(rgbSize);
+			std::vector<uint8_t> depth(depthSize);
+			frame.truth.resize(markerCount);
+			if (!file.read((char *)frame.rgb.data(), rgbSize) || !file.read((char *)depth.data(), depthSize) || !file.read((char *)frame.truth.data(), markerCount * sizeof(Replay::TruthMarker)))
+			{
+				return false;
+			}
+			return decoder.Decode(depth, frame.depth);
+		}
+	};
+}
@@ -0,0 +1,342 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace FRC_Kinect
+{
+	// append only binary log of frame timings and marker detections
+	//
+	// the file is a 64 byte header followed by fixed 64 byte records. producers write into a per thread staging ring without
+	// locking or waiting, a flush thread copies the rings into the memory mapped file in the background.
+	namespace Telemetry
+	{
+		const uint32_t Version = 1;
+		const int HeaderSize = 64;
+
+		enum RecordType
+		{
+			FrameRecord = 1,
+			MarkerRecord = 2
+		};
+
+		enum Stage
+		{
+			StageDepth = 0,
+			StageRgb,
+			StageDetect,
+			StageRender,
+			StageFrame,
+			StageSegment,
+			// stages this build records, written to the header
+			StageCount,
+			// room in a frame record, later stages fit without changing the record layout
+			StageCapacity = 8
+		};
+
+		inline const char *StageName(int stage)
+		{
+			static const char *names[StageCapacity] = {"depth", "rgb", "detect", "render", "frame", "segment", "stage6", "stage7"};
+			return names[stage];
+		}
+
+		struct Header
+		{
+			char magic[4];
+			uint32_t version;
+			uint32_t recordSize;
+			uint32_t stageCount;
+			uint64_t recordCount;
+			// records lost because a staging ring was full
+			uint64_t dropped;
+			uint8_t reserved[32];
+		};
+
+		struct Record
+		{
+			uint8_t type;
+			uint8_t reserved[7];
+			uint64_t frame;
+			union
+			{
+				struct
+				{
+					// steady clock ns when the rgb and depth frames arrived
+					uint64_t rgbCapture;
+					uint64_t depthCapture;
+					// ms
+					float stages[StageCapacity];
+				} timing;
+				struct
+				{
+					int16_t id;
+					int16_t dictionary;
+					// normalized x, y in detector order: top left, top right, bottom right, bottom left
+					float corners[8];
+					// raw 11 bit depth at the corners (same order) and center
+					uint16_t depth[5];
+				} marker;
+			};
+		};
+
+		static_assert(sizeof(Header) == HeaderSize, "telemetry header must stay 64 bytes");
+		static_assert(sizeof(Record) == 64, "telemetry records must stay 64 bytes");
+
+		inline uint64_t Now()
+		{
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+
+		inline uint64_t Timestamp(std::chrono::steady_clock::time_point time)
+		{
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+		}
+	}
+
+	class TelemetryLog
+	{
+	private:
+		// single producer single consumer ring, the producer never blocks
+		struct StagingRing
+		{
+			static const int Capacity = 4096;
+			Telemetry::Record records[Capacity];
+			std::atomic<uint64_t> head{0};
+			std::atomic<uint64_t> tail{0};
+		};
+
+		// identifies this log to the per thread ring lookup, addresses can be reused
+		uint64_t instance;
+		int file = -1;
+		Telemetry::Header *header = nullptr;
+		uint8_t *mapping = nullptr;
+		size_t mappedSize = 0;
+		uint64_t recordCount = 0;
+		std::atomic<uint64_t> dropped{0};
+
+		std::mutex ringMutex;
+		std::vector<std::unique_ptr<StagingRing>> rings;
+
+		int flushInterval;
+		std::atomic<bool> running{false};
+		std::mutex flushMutex;
+		std::condition_variable flushWake;
+		std::thread flushThread;
+
+		StagingRing *ring()
+		{
+			thread_local uint64_t owner = 0;
+			thread_local StagingRing *staging = nullptr;
+			if (owner != instance)
+			{
+				// first record from this thread, registering is the only time a producer takes a lock
+				std::lock_guard<std::mutex> lock(ringMutex);
+				rings.push_back(std::unique_ptr<StagingRing>(new StagingRing()));
+				staging = rings.back().get();
+				owner = instance;
+			}
+			return staging;
+		}
+
+		void push(const Telemetry::Record &record)
+		{
+			StagingRing *staging = ring();
+			uint64_t head = staging->head.load(std::memory_order_relaxed);
+			if (head - staging->tail.load(std::memory_order_acquire) >= StagingRing::Capacity)
+			{
+				dropped.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			staging->records[head % StagingRing::Capacity] = record;
+			staging->head.store(head + 1, std::memory_order_release);
+		}
+
+		bool map(size_t size)
+		{
+			if (mapping)
+			{
+				munmap(mapping, mappedSize);
+				mapping = nullptr;
+				header = nullptr;
+			}
+			if (ftruncate(file, size) != 0)
+			{
+				return false;
+			}
+			void *address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+			if (address == MAP_FAILED)
+			{
+				return false;
+			}
+			mapping = (uint8_t *)address;
+			header = (Telemetry::Header *)mapping;
+			mappedSize = size;
+			return true;
+		}
+
+		void flush()
+		{
+			std::vector<StagingRing *> staging;
+			{
+				std::lock_guard<std::mutex> lock(ringMutex);
+				for (int i = 0; i < rings.size(); i++)
+				{
+					staging.push_back(rings[i].get());
+				}
+			}
+			for (int i = 0; i < staging.size(); i++)
+			{
+				uint64_t tail = staging[i]->tail.load(std::memory_order_relaxed);
+				uint64_t head = staging[i]->head.load(std::memory_order_acquire);
+				for (; tail < head; tail++)
+				{
+					size_t offset = Telemetry::HeaderSize + recordCount * sizeof(Telemetry::Record);
+					if (offset + sizeof(Telemetry::Record) > mappedSize && !map(mappedSize * 2))
+					{
+						// out of disk, count what is left as dropped
+						dropped.fetch_add(head - tail, std::memory_order_relaxed);
+						tail = head;
+						break;
+					}
+					memcpy(mapping + offset, &staging[i]->records[tail % StagingRing::Capacity], sizeof(Telemetry::Record));
+					recordCount++;
+				}
+				staging[i]->tail.store(tail, std::memory_order_release);
+			}
+			if (header)
+			{
+				header->recordCount = recordCount;
+				header->dropped = dropped.load(std::memory_order_relaxed);
+			}
+		}
+
+		void flushLoop()
+		{
+			std::unique_lock<std::mutex> lock(flushMutex);
+			while (running)
+			{
+				flushWake.wait_for(lock, std::chrono::milliseconds(flushInterval));
+				flush();
+			}
+		}
+
+	public:
+		// flushInterval in ms, the staging rings hold 4096 records per thread between flushes
+		TelemetryLog(int flushInterval = 50)
+		{
+			static std::atomic<uint64_t> instances{0};
+			this->instance = ++instances;
+			this->flushInterval = flushInterval;
+		}
+
+		~TelemetryLog()
+		{
+			Close();
+		}
+
+		bool Open(std::string path)
+		{
+			file = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+			if (file < 0 || !map(Telemetry::HeaderSize + 65536 * sizeof(Telemetry::Record)))
+			{
+				Close();
+				return false;
+			}
+			memset(header, 0, sizeof(Telemetry::Header));
+			memcpy(header->magic, "FKTL", 4);
+			header->version = Telemetry::Version;
+			header->recordSize = sizeof(Telemetry::Record);
+			header->stageCount = Telemetry::StageCount;
+			recordCount = 0;
+			running = true;
+			flushThread = std::thread(&TelemetryLog::flushLoop, this);
+			return true;
+		}
+
+		// flushes everything staged and trims the file to the records written
+		void Close()
+		{
+			if (running)
+			{
+				{
+					std::lock_guard<std::mutex> lock(flushMutex);
+					running = false;
+				}
+				flushWake.notify_all();
+				flushThread.join();
+				flush();
+			}
+			if (mapping)
+			{
+				msync(mapping, mappedSize, MS_SYNC);
+				munmap(mapping, mappedSize);
+				mapping = nullptr;
+				header = nullptr;
+			}
+			if (file >= 0)
+			{
+				if (mappedSize > 0 && ftruncate(file, Telemetry::HeaderSize + recordCount * sizeof(Telemetry::Record)) != 0)
+				{
+					perror("telemetry");
+				}
+				close(file);
+				file = -1;
+			}
+			mappedSize = 0;
+		}
+
+		bool IsOpen()
+		{
+			return running;
+		}
+
+		uint64_t getDropped()
+		{
+			return dropped.load(std::memory_order_relaxed);
+		}
+
+		void LogFrame(uint64_t frame, uint64_t rgbCapture, uint64_t depthCapture, const float stages[Telemetry::StageCount])
+		{
+			if (!running)
+			{
+				return;
+			}
+			Telemetry::Record record = {};
+			record.type = Telemetry::FrameRecord;
+			record.frame = frame;
+			record.timing.rgbCapture = rgbCapture;
+			record.timing.depthCapture = depthCapture;
+			memcpy(record.timing.stages, stages, Telemetry::StageCount * sizeof(float));
+			push(record);
+		}
+
+		void LogMarker(uint64_t frame, int id, int dictionary, const float corners[8], const uint16_t depth[5])
+		{
+			if (!running)
+			{
+				return;
+			}
+			Telemetry::Record record = {};
+			record.type = Telemetry::MarkerRecord;
+			record.frame = frame;
+			record.marker.id = id;
+			record.marker.dictionary = dictionary;
+			memcpy(record.marker.corners, corners, sizeof(record.marker.corners));
+			memcpy(record.marker.depth, depth, sizeof(record.marker.depth));
+			push(record);
+		}
+	};
+}
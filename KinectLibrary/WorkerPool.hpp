@@ -0,0 +1,130 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+
+namespace FRC_Kinect
+{
+	// persistent threads shared by the per frame stages so they do not pay for starting threads every frame
+	class WorkerPool
+	{
+	private:
+		struct Job
+		{
+			std::function<void(int)> work;
+			int count;
+			std::atomic<int> next{0};
+			std::atomic<int> remaining{0};
+		};
+
+		std::vector<std::thread> threads;
+		std::mutex mutex;
+		std::condition_variable wake;
+		std::condition_variable done;
+		std::shared_ptr<Job> job;
+		uint64_t generation = 0;
+		bool stopping = false;
+		// one parallelFor at a time, jobs must not call parallelFor themselves
+		std::mutex callMutex;
+
+		void run(std::shared_ptr<Job> current)
+		{
+			int completed = 0;
+			for (int i = current->next++; i < current->count; i = current->next++)
+			{
+				current->work(i);
+				completed++;
+			}
+			if (completed > 0 && current->remaining.fetch_sub(completed) == completed)
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				done.notify_all();
+			}
+		}
+
+		void worker()
+		{
+			uint64_t seen = 0;
+			while (true)
+			{
+				std::shared_ptr<Job> current;
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					wake.wait(lock, [&]()
+							  { return stopping || generation != seen; });
+					if (stopping)
+					{
+						return;
+					}
+					seen = generation;
+					current = job;
+				}
+				run(current);
+			}
+		}
+
+	public:
+		// the calling thread works too, so the pool starts one thread less than it uses
+		WorkerPool(int threadcount = std::thread::hardware_concurrency())
+		{
+			for (int i = 1; i < threadcount; i++)
+			{
+				threads.push_back(std::thread(&WorkerPool::worker, this));
+			}
+		}
+
+		~WorkerPool()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping = true;
+			}
+			wake.notify_all();
+			for (int i = 0; i < threads.size(); i++)
+			{
+				threads[i].join();
+			}
+		}
+
+		int getThreadCount()
+		{
+			return threads.size() + 1;
+		}
+
+		// runs work(0) .. work(count - 1) across the pool and returns once all of them are done
+		void parallelFor(int count, std::function<void(int)> work)
+		{
+			if (count <= 0)
+			{
+				return;
+			}
+			std::lock_guard<std::mutex> call(callMutex);
+			std::shared_ptr<Job> current = std::make_shared<Job>();
+			current->work = work;
+			current->count = count;
+			current->remaining = count;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				job = current;
+				generation++;
+			}
+			wake.notify_all();
+			run(current);
+			std::unique_lock<std::mutex> lock(mutex);
+			done.wait(lock, [&]()
+					  { return current->remaining == 0; });
+		}
+	};
+
+	inline WorkerPool &SharedWorkerPool()
+	{
+		static WorkerPool pool;
+		return pool;
+	}
+}
@@ -6,6 +6,17 @@
 #include <algorithm>
 #include <thread>
 #include <fstream>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <random>
+#include <deque>
+#include <cinttypes>
 
 #include <GL/freeglut.h>
 #include <GL/gl.h>
@@ -19,130 +30,367 @@
 #include <CL/opencl.hpp>
 #endif
 
+#include "DepthCodec.hpp"
+#include "Telemetry.hpp"
+#include "Replay.hpp"
+#include "Helpers.hpp"
+#include "BoundingBox.hpp"
+#include "Marker.hpp"
+#include "WorkerPool.hpp"
+#include "DepthSegmenter.hpp"
+#include "DashboardStream.hpp"
+
 namespace FRC_Kinect
 {
-	float _lerp(float a, float b, float t)
+	// use opencv to find apriltags 36h11
+	// decimation > 1 searches a downscaled image, regions limits the search to those parts of the image (empty is the whole image)
+	std::vector<Marker> findApriltags(cv::Mat image, std::vector<uint16_t> deapthData, std::vector<cv::aruco::PredefinedDictionaryType> dictionaryType = {cv::aruco::DICT_6X6_250}, float decimation = 1, std::vector<cv::Rect> regions = {})
 	{
-		return a + (b - a) * t;
+		std::vector<Marker> boxes;
+		cv::Mat gray;
+		cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
+		if (regions.size() == 0)
+		{
+			regions.push_back(cv::Rect(0, 0, gray.cols, gray.rows));
+		}
+		for (int i = 0; i < dictionaryType.size(); i++)
+		{
+			cv::aruco::Dictionary dictionary = cv::aruco::getPredefinedDictionary(dictionaryType[i]);
+			cv::aruco::DetectorParameters detectorParams = cv::aruco::DetectorParameters();
+			detectorParams.cornerRefinementMethod = cv::aruco::CORNER_REFINE_SUBPIX;
+			detectorParams.cornerRefinementWinSize = 5;
+			detectorParams.cornerRefinementMaxIterations = 30;
+			detectorParams.cornerRefinementMinAccuracy = .5;
+			cv::aruco::ArucoDetector detector(dictionary, detectorParams);
+			for (int r = 0; r < regions.size(); r++)
+			{
+				cv::Rect region = regions[r] & cv::Rect(0, 0, gray.cols, gray.rows);
+				if (region.width <= 0 || region.height <= 0)
+				{
+					continue;
+				}
+				cv::Mat search = gray(region);
+				if (decimation > 1)
+				{
+					cv::resize(search, search, cv::Size(), 1 / decimation, 1 / decimation, cv::INTER_AREA);
+				}
+				std::vector<int> markerIds;
+				std::vector<std::vector<cv::Point2f>> markerCorners, rejectedCandidates;
+				detector.detectMarkers(search, markerCorners, markerIds, rejectedCandidates);
+				for (int j = 0; j < markerIds.size(); j++)
+				{
+					// back to full image pixels
+					for (int k = 0; k < markerCorners[j].size(); k++)
+					{
+						if (decimation > 1)
+						{
+							// area resampling puts each small pixel center at the middle of its block
+							markerCorners[j][k] = markerCorners[j][k] * decimation + cv::Point2f((decimation - 1) / 2, (decimation - 1) / 2);
+						}
+						markerCorners[j][k].x = std::min(markerCorners[j][k].x + region.x, (float)image.cols - 1);
+						markerCorners[j][k].y = std::min(markerCorners[j][k].y + region.y, (float)image.rows - 1);
+					}
+					boxes.push_back(Marker::fromCornerPoints(markerCorners[j], markerIds[j], image.cols, image.rows));
+					boxes.back().dictionary = dictionaryType[i];
+					boxes.back().DetrmineDepth(deapthData, image.cols, image.rows);
+				}
+			}
+		}
+		return boxes;
 	}
 
-	float _map(float value, float istart, float istop, float ostart, float ostop)
+	// what the scheduler wants done with the current frame
+	struct DetectionPlan
 	{
-		return ostart + (ostop - ostart) * ((value - istart) / (istop - istart));
-	}
+		// frame is stale or already processed, reuse the last markers
+		bool skip = false;
+		int level = 0;
+		std::vector<cv::aruco::PredefinedDictionaryType> dictionaries;
+		float decimation = 1;
+		// pixel regions to search, empty searches the whole image
+		std::vector<cv::Rect> regions;
+	};
 
-	struct boundingBox
+	// a single adaptation made by the scheduler
+	struct SchedulerDecision
 	{
-		glm::vec3 topLeft;
-		glm::vec3 topRight;
-		glm::vec3 bottomLeft;
-		glm::vec3 bottomRight;
-		glm::vec3 center;
+		uint64_t frame;
+		std::string action;
+		std::string reason;
+		int level;
+		// smoothed capture to result latency and the budget it was compared to, in ms
+		float latency;
+		float budget;
+	};
 
-		boundingBox(glm::vec3 topLeft, glm::vec3 topRight, glm::vec3 bottomLeft, glm::vec3 bottomRight)
+	// keeps capture to result latency inside a per frame budget by shedding detection work under pressure
+	class FrameScheduler
+	{
+	public:
+		enum Level
 		{
-			this->topLeft = topLeft;
-			this->topRight = topRight;
-			this->bottomLeft = bottomLeft;
-			this->bottomRight = bottomRight;
-			this->center = glm::vec3((topLeft.x + topRight.x + bottomLeft.x + bottomRight.x) / 4, (topLeft.y + topRight.y + bottomLeft.y + bottomRight.y) / 4, (topLeft.z + topRight.z + bottomLeft.z + bottomRight.z) / 4);
+			Full = 0,
+			ReducedDictionaries,
+			Decimated,
+			TrackedOnly
+		};
+
+	private:
+		std::vector<cv::aruco::PredefinedDictionaryType> dictionaries;
+		// last frame each dictionary found a marker in
+		std::vector<uint64_t> dictionaryLastHit;
+		int dictionaryRotation = 0;
+		uint64_t dictionaryMemory = 60;
+
+		float budget;
+		int level = Full;
+		int overBudgetFrames = 0;
+		int underBudgetFrames = 0;
+		int escalateAfter = 3;
+		int recoverAfter = 30;
+		// fraction of the budget the latency has to stay under before recovering a level
+		float headroom = 0.6f;
+		float smoothing = 0.2f;
+
+		std::map<std::string, float> stageCosts;
+		float latency = 0;
+
+		bool hasFrame = false;
+		uint64_t lastFrame = 0;
+		bool lastDropped = false;
+		bool repeatedFrame = false;
+		DetectionPlan plan;
+		float planFrameAge = 0;
+		std::chrono::steady_clock::time_point planTime;
+
+		std::vector<Marker> tracked;
+		int width = 640;
+		int height = 480;
+		float trackedMargin = 0.5f;
+		int fullSearchInterval = 15;
+		int framesSinceFullSearch = 0;
+
+		std::function<void(const SchedulerDecision &)> onDecision;
+
+		void report(uint64_t frame, std::string action, std::string reason)
+		{
+			SchedulerDecision decision = {frame, action, reason, level, latency, budget};
+			if (onDecision)
+			{
+				onDecision(decision);
+			}
 		}
 
-		boundingBox()
+		std::vector<cv::aruco::PredefinedDictionaryType> activeDictionaries(uint64_t frame)
 		{
-			this->topLeft = glm::vec3(0, 0, 0);
-			this->topRight = glm::vec3(0, 0, 0);
-			this->bottomLeft = glm::vec3(0, 0, 0);
-			this->bottomRight = glm::vec3(0, 0, 0);
-			this->center = glm::vec3(0, 0, 0);
+			if (level < ReducedDictionaries || dictionaries.size() <= 1)
+			{
+				return dictionaries;
+			}
+			// keep dictionaries that found something recently and rotate one more through so new markers are still picked up
+			std::vector<cv::aruco::PredefinedDictionaryType> active;
+			for (int i = 0; i < dictionaries.size(); i++)
+			{
+				if (dictionaryLastHit[i] != 0 && frame - dictionaryLastHit[i] < dictionaryMemory)
+				{
+					active.push_back(dictionaries[i]);
+				}
+			}
+			dictionaryRotation = (dictionaryRotation + 1) % dictionaries.size();
+			if (std::find(active.begin(), active.end(), dictionaries[dictionaryRotation]) == active.end())
+			{
+				active.push_back(dictionaries[dictionaryRotation]);
+			}
+			return active;
 		}
 
-		static boundingBox fromRect(cv::Rect rect)
+		std::vector<cv::Rect> trackedRegions()
 		{
-			return boundingBox(glm::vec3(rect.x, rect.y, 0), glm::vec3(rect.x + rect.width, rect.y, 0), glm::vec3(rect.x, rect.y + rect.height, 0), glm::vec3(rect.x + rect.width, rect.y + rect.height, 0));
+			std::vector<cv::Rect> regions;
+			for (int i = 0; i < tracked.size(); i++)
+			{
+				float minX = std::min(std::min(tracked[i].topLeft.x, tracked[i].topRight.x), std::min(tracked[i].bottomLeft.x, tracked[i].bottomRight.x));
+				float maxX = std::max(std::max(tracked[i].topLeft.x, tracked[i].topRight.x), std::max(tracked[i].bottomLeft.x, tracked[i].bottomRight.x));
+				float minY = std::min(std::min(tracked[i].topLeft.y, tracked[i].topRight.y), std::min(tracked[i].bottomLeft.y, tracked[i].bottomRight.y));
+				float maxY = std::max(std::max(tracked[i].topLeft.y, tracked[i].topRight.y), std::max(tracked[i].bottomLeft.y, tracked[i].bottomRight.y));
+				float marginX = (maxX - minX) * trackedMargin;
+				float marginY = (maxY - minY) * trackedMargin;
+				cv::Rect region(cv::Point((minX - marginX) * width, (minY - marginY) * height), cv::Point((maxX + marginX) * width, (maxY + marginY) * height));
+				regions.push_back(region & cv::Rect(0, 0, width, height));
+			}
+			// merge overlapping regions so a marker is not found twice
+			for (int i = 0; i < regions.size(); i++)
+			{
+				for (int j = i + 1; j < regions.size(); j++)
+				{
+					if ((regions[i] & regions[j]).area() > 0)
+					{
+						regions[i] |= regions[j];
+						regions.erase(regions.begin() + j);
+						j = i;
+					}
+				}
+			}
+			return regions;
 		}
 
-		static boundingBox fromCornerPoints(std::vector<cv::Point2f> points)
+	public:
+		FrameScheduler(std::vector<cv::aruco::PredefinedDictionaryType> dictionaries, float targetFps = 30)
 		{
-			return boundingBox(glm::vec3(points[0].x, points[0].y, 0), glm::vec3(points[1].x, points[1].y, 0), glm::vec3(points[2].x, points[2].y, 0), glm::vec3(points[3].x, points[3].y, 0));
+			this->dictionaries = dictionaries;
+			this->dictionaryLastHit.resize(dictionaries.size(), 0);
+			setTargetFps(targetFps);
 		}
-	};
 
-	struct Marker : public boundingBox
-	{
-		int id;
+		void setTargetFps(float fps)
+		{
+			this->budget = 1000.0f / fps;
+		}
 
-		Marker(glm::vec3 topLeft, glm::vec3 topRight, glm::vec3 bottomLeft, glm::vec3 bottomRight, int id) : boundingBox(topLeft, topRight, bottomLeft, bottomRight)
+		float getBudget()
 		{
-			this->id = id;
+			return budget;
 		}
 
-		Marker() : boundingBox()
+		int getLevel()
 		{
-			this->id = -1;
+			return level;
 		}
 
-		static Marker fromCornerPoints(std::vector<cv::Point2f> points, int id, int width, int height)
+		float getLatency()
 		{
-			return Marker(glm::vec3(points[0].x / (float)width, points[0].y / (float)height, 0), glm::vec3(points[1].x / (float)width, points[1].y / (float)height, 0), glm::vec3(points[2].x / (float)width, points[2].y / (float)height, 0), glm::vec3(points[3].x / (float)width, points[3].y / (float)height, 0), id);
+			return latency;
 		}
 
-		static Marker fromRect(cv::Rect rect, int id, int width, int height)
+		float getStageCost(std::string stage)
 		{
-			return Marker(glm::vec3(rect.x / (float)width, rect.y / (float)height, 0), glm::vec3((rect.x + rect.width) / (float)width, rect.y / (float)height, 0), glm::vec3(rect.x / (float)width, (rect.y + rect.height) / (float)height, 0), glm::vec3((rect.x + rect.width) / (float)width, (rect.y + rect.height) / (float)height, 0), id);
+			return stageCosts.count(stage) ? stageCosts[stage] : 0;
 		}
 
-		void DetrmineDepth(std::vector<uint16_t> depth, int width, int height)
+		void setImageSize(int width, int height)
 		{
-			// get the corners and center from normalized coordinates
-			glm::vec3 topLeft = glm::vec3(_map(this->topLeft.x, 0, 1, 0, width), _map(this->topLeft.y, 0, 1, 0, height), 0);
-			glm::vec3 topRight = glm::vec3(_map(this->topRight.x, 0, 1, 0, width), _map(this->topRight.y, 0, 1, 0, height), 0);
-			glm::vec3 bottomLeft = glm::vec3(_map(this->bottomLeft.x, 0, 1, 0, width), _map(this->bottomLeft.y, 0, 1, 0, height), 0);
-			glm::vec3 bottomRight = glm::vec3(_map(this->bottomRight.x, 0, 1, 0, width), _map(this->bottomRight.y, 0, 1, 0, height), 0);
-			glm::vec3 center = glm::vec3((topLeft.x + topRight.x + bottomLeft.x + bottomRight.x) / 4, (topLeft.y + topRight.y + bottomLeft.y + bottomRight.y) / 4, 0);
+			this->width = width;
+			this->height = height;
+		}
 
-			// get the depth data
-			float depthTopLeft = _map(depth[(int)topLeft.y * width + (int)topLeft.x], 0, 2048, 0, 1);
-			float depthTopRight = _map(depth[(int)topRight.y * width + (int)topRight.x], 0, 2048, 0, 1);
-			float depthBottomLeft = _map(depth[(int)bottomLeft.y * width + (int)bottomLeft.x], 0, 2048, 0, 1);
-			float depthBottomRight = _map(depth[(int)bottomRight.y * width + (int)bottomRight.x], 0, 2048, 0, 1);
-			float depthCenter = _map(depth[(int)center.y * width + (int)center.x], 0, 2048, 0, 1);
+		void setDecisionCallback(std::function<void(const SchedulerDecision &)> onDecision)
+		{
+			this->onDecision = onDecision;
+		}
 
-			// set the depth data
-			this->topLeft.z = depthTopLeft;
-			this->topRight.z = depthTopRight;
-			this->bottomLeft.z = depthBottomLeft;
-			this->bottomRight.z = depthBottomRight;
-			this->center.z = depthCenter;
+		// smoothed cost of a pipeline stage in ms
+		void RecordStage(std::string stage, float milliseconds)
+		{
+			if (stageCosts.count(stage) == 0)
+			{
+				stageCosts[stage] = milliseconds;
+			}
+			else
+			{
+				stageCosts[stage] = _lerp(stageCosts[stage], milliseconds, smoothing);
+			}
 		}
-	};
 
-	// use opencv to find apriltags 36h11
-	std::vector<Marker> findApriltags(cv::Mat image, std::vector<uint16_t> deapthData, std::vector<cv::aruco::PredefinedDictionaryType> dictionaryType = {cv::aruco::DICT_6X6_250})
-	{
-		std::vector<Marker> boxes;
-		cv::Mat gray;
-		cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
-		for (int i = 0; i < dictionaryType.size(); i++)
+		// decide what to do with a frame that was captured frameAge ms ago
+		DetectionPlan Plan(uint64_t frame, float frameAge)
 		{
-			std::vector<int> markerIds;
-			std::vector<std::vector<cv::Point2f>> markerCorners, rejectedCandidates;
-			cv::aruco::Dictionary dictionary = cv::aruco::getPredefinedDictionary(dictionaryType[i]);
-			cv::aruco::DetectorParameters detectorParams = cv::aruco::DetectorParameters();
-			detectorParams.cornerRefinementMethod = cv::aruco::CORNER_REFINE_SUBPIX;
-			detectorParams.cornerRefinementWinSize = 5;
-			detectorParams.cornerRefinementMaxIterations = 30;
-			detectorParams.cornerRefinementMinAccuracy = .5;
-			cv::aruco::ArucoDetector detector(dictionary, detectorParams);
-			detector.detectMarkers(gray, markerCorners, markerIds, rejectedCandidates);
-			for (int i = 0; i < markerIds.size(); i++)
+			plan = DetectionPlan();
+			plan.level = level;
+			planFrameAge = frameAge;
+			planTime = std::chrono::steady_clock::now();
+
+			repeatedFrame = hasFrame && frame == lastFrame;
+			if (repeatedFrame)
 			{
-				boxes.push_back(Marker::fromCornerPoints(markerCorners[i], markerIds[i], image.cols, image.rows));
-				boxes.back().DetrmineDepth(deapthData, image.cols, image.rows);
+				// nothing new since the last detection
+				plan.skip = true;
+				return plan;
 			}
+			hasFrame = true;
+			lastFrame = frame;
+
+			// results would land more than two frames late, drop this one unless the last one was dropped too so detection still makes progress
+			if (frameAge + getStageCost("detect") > budget * 2 && !lastDropped)
+			{
+				plan.skip = true;
+				lastDropped = true;
+				report(frame, "drop", "frame is " + std::to_string((int)frameAge) + "ms old");
+				return plan;
+			}
+			lastDropped = false;
+
+			plan.dictionaries = activeDictionaries(frame);
+			if (level >= Decimated)
+			{
+				plan.decimation = 2;
+			}
+			if (level >= TrackedOnly && tracked.size() > 0 && framesSinceFullSearch < fullSearchInterval)
+			{
+				plan.regions = trackedRegions();
+				plan.decimation = 1;
+				framesSinceFullSearch++;
+			}
+			else
+			{
+				framesSinceFullSearch = 0;
+			}
+			return plan;
 		}
-		return boxes;
-	}
+
+		// feed back the result of the last plan
+		void Complete(std::vector<Marker> markers)
+		{
+			if (repeatedFrame)
+			{
+				return;
+			}
+			float frameLatency = planFrameAge + _millisecondsSince(planTime);
+			latency = latency == 0 ? frameLatency : _lerp(latency, frameLatency, smoothing);
+			if (!plan.skip)
+			{
+				for (int i = 0; i < markers.size(); i++)
+				{
+					for (int j = 0; j < dictionaries.size(); j++)
+					{
+						if (dictionaries[j] == markers[i].dictionary)
+						{
+							dictionaryLastHit[j] = lastFrame;
+						}
+					}
+				}
+				tracked = markers;
+			}
+
+			if (latency > budget)
+			{
+				overBudgetFrames++;
+				underBudgetFrames = 0;
+			}
+			else if (latency < budget * headroom)
+			{
+				underBudgetFrames++;
+				overBudgetFrames = 0;
+			}
+			else
+			{
+				overBudgetFrames = 0;
+				underBudgetFrames = 0;
+			}
+
+			if (overBudgetFrames >= escalateAfter && level < TrackedOnly)
+			{
+				level++;
+				overBudgetFrames = 0;
+				report(lastFrame, "escalate", "latency " + std::to_string((int)latency) + "ms over budget");
+			}
+			else if (underBudgetFrames >= recoverAfter && level > Full)
+			{
+				level--;
+				underBudgetFrames = 0;
+				report(lastFrame, "recover", "latency " + std::to_string((int)latency) + "ms has headroom");
+			}
+		}
+	};
 
 	struct Color
 	{
@@ -221,6 +469,47 @@ namespace FRC_Kinect
 		std::vector<uint16_t> DeapthData;
 		Mutex DeapthMutex;
 		bool NewDeapthFrame;
+		uint64_t DeapthFrameSequence = 0;
+		std::chrono::steady_clock::time_point DeapthFrameTime;
+
+		// optional lossless compression of every depth frame, the capture thread only queues a copy for the encoder thread
+		struct QueuedDeapthFrame
+		{
+			std::vector<uint16_t> depth;
+			uint64_t sequence;
+			uint64_t timestamp;
+		};
+		DepthEncoder *deapthEncoder = nullptr;
+		std::function<void(const std::vector<uint8_t> &, uint64_t, uint64_t)> deapthSink;
+		std::thread deapthEncoderThread;
+		std::mutex DeapthEncoderMutex;
+		std::condition_variable deapthEncoderWake;
+		std::deque<QueuedDeapthFrame> deapthEncoderQueue;
+		int deapthEncoderQueueLimit = 30;
+		bool deapthEncoderRunning = false;
+		uint64_t deapthEncoderDropped = 0;
+
+		void compressDepth()
+		{
+			std::unique_lock<std::mutex> lock(DeapthEncoderMutex);
+			while (true)
+			{
+				deapthEncoderWake.wait(lock, [this]()
+									   { return !deapthEncoderRunning || deapthEncoderQueue.size() > 0; });
+				// drain what is queued before stopping so the sink gets every accepted frame
+				if (deapthEncoderQueue.size() == 0)
+				{
+					return;
+				}
+				QueuedDeapthFrame frame = std::move(deapthEncoderQueue.front());
+				deapthEncoderQueue.pop_front();
+				lock.unlock();
+				deapthSink(deapthEncoder->Encode(frame.depth.data()), frame.sequence, frame.timestamp);
+				lock.lock();
+			}
+		}
+
+		DepthSegmenter segmenter;
 
 		std::vector<Color> colors;
 		float colorClipDistanceFront = 0;
@@ -233,6 +522,8 @@ namespace FRC_Kinect
 		std::vector<uint8_t> ImageData;
 		Mutex ImageMutex;
 		bool NewImageFrame;
+		uint64_t ImageFrameSequence = 0;
+		std::chrono::steady_clock::time_point ImageFrameTime;
 
 #ifdef GraphicCard
 		// opencl
@@ -308,30 +599,20 @@ namespace FRC_Kinect
 			queue.enqueueReadBuffer(bufferColor, CL_TRUE, 0, DeapthDataSize * sizeof(uint8_t) * 3, &data[0]);
 #else
 			// cpu
-			int threadcount = 15;
-			std::vector<std::thread> threads;
-
-			for (int i = 0; i < threadcount; i++)
-			{
-				std::vector<Color> colors = this->colors;
-				threads.push_back(std::thread([&, i, colors]()
-											  {
-					for (int j = i * DeapthDataSize / threadcount; j < (i + 1) * DeapthDataSize / threadcount; j++)
-					{
-						// get the depth data
-						float depth = _map(DeapthData[j], 0, 2048, 0, 1);
-						Color color = Color::Gradient(_map(depth, 0, 1, colorClipDistanceFront_off - colorClipDistanceFront, colorClipDistanceBack_off - colorClipDistanceBack), colors);
-						// set the color
-						data[j * 3] = color.r * 255;
-						data[j * 3 + 1] = color.g * 255;
-						data[j * 3 + 2] = color.b * 255;
-					} }));
-			}
-
-			for (int i = 0; i < threadcount; i++)
-			{
-				threads[i].join();
-			}
+			int chunks = 48;
+			std::vector<Color> colors = this->colors;
+			SharedWorkerPool().parallelFor(chunks, [&](int i)
+										   {
+				for (int j = i * DeapthDataSize / chunks; j < (i + 1) * DeapthDataSize / chunks; j++)
+				{
+					// get the depth data
+					float depth = _map(DeapthData[j], 0, 2048, 0, 1);
+					Color color = Color::Gradient(_map(depth, 0, 1, colorClipDistanceFront_off - colorClipDistanceFront, colorClipDistanceBack_off - colorClipDistanceBack), colors);
+					// set the color
+					data[j * 3] = color.r * 255;
+					data[j * 3 + 1] = color.g * 255;
+					data[j * 3 + 2] = color.b * 255;
+				} });
 #endif
 			return data;
 		}
@@ -361,6 +642,11 @@ namespace FRC_Kinect
 #endif
 		}
 
+		~Kinect()
+		{
+			disableDepthCompression();
+		}
+
 		void VideoCallback(void *_rgb, uint32_t timestamp)
 		{
 			ImageMutex.lock();
@@ -372,6 +658,8 @@ namespace FRC_Kinect
 			}
 			copy(rgb, rgb + getVideoBufferSize(), ImageData.begin());
 			NewImageFrame = true;
+			ImageFrameSequence++;
+			ImageFrameTime = std::chrono::steady_clock::now();
 			ImageMutex.unlock();
 		};
 
@@ -386,7 +674,63 @@ namespace FRC_Kinect
 			}
 			copy(depth, depth + getDepthBufferSize(), DeapthData.begin());
 			NewDeapthFrame = true;
+			uint64_t sequence = ++DeapthFrameSequence;
+			DeapthFrameTime = std::chrono::steady_clock::now();
+			uint64_t captured = Telemetry::Timestamp(DeapthFrameTime);
 			DeapthMutex.unlock();
+
+			// queue a copy for the encoder thread, a full queue drops the frame rather than stall the usb thread
+			std::lock_guard<std::mutex> lock(DeapthEncoderMutex);
+			if (deapthEncoderRunning)
+			{
+				if (deapthEncoderQueue.size() >= deapthEncoderQueueLimit)
+				{
+					deapthEncoderDropped++;
+				}
+				else
+				{
+					deapthEncoderQueue.push_back({std::vector<uint16_t>(depth, depth + DeapthDataSize), sequence, captured});
+					deapthEncoderWake.notify_one();
+				}
+			}
+		}
+
+		// compress every depth frame with the lossless depth codec and hand it to sink along with its frame sequence and capture time (steady clock ns)
+		// sink runs on the encoder thread, frames arrive in order
+		void enableDepthCompression(std::function<void(const std::vector<uint8_t> &, uint64_t, uint64_t)> sink, int threadcount = 1)
+		{
+			disableDepthCompression();
+			std::lock_guard<std::mutex> lock(DeapthEncoderMutex);
+			deapthEncoder = new DepthEncoder(640, 480, threadcount);
+			deapthSink = sink;
+			deapthEncoderDropped = 0;
+			deapthEncoderRunning = true;
+			deapthEncoderThread = std::thread(&Kinect::compressDepth, this);
+		}
+
+		// waits for the queued frames to be encoded and handed to the sink
+		void disableDepthCompression()
+		{
+			{
+				std::lock_guard<std::mutex> lock(DeapthEncoderMutex);
+				if (!deapthEncoderRunning)
+				{
+					return;
+				}
+				deapthEncoderRunning = false;
+			}
+			deapthEncoderWake.notify_all();
+			deapthEncoderThread.join();
+			delete deapthEncoder;
+			deapthEncoder = nullptr;
+			deapthSink = nullptr;
+		}
+
+		// depth frames the encoder thread could not keep up with
+		uint64_t getDepthCompressionDropped()
+		{
+			std::lock_guard<std::mutex> lock(DeapthEncoderMutex);
+			return deapthEncoderDropped;
 		}
 
 		bool getRGB(cv::Mat &output)
@@ -447,8 +791,79 @@ namespace FRC_Kinect
 			ImageMutex.unlock();
 			return markers;
 		}
+
+		std::vector<Marker> GetMarkers(DetectionPlan plan)
+		{
+			std::vector<Marker> markers;
+			ImageMutex.lock();
+			markers = findApriltags(cv::Mat(480, 640, CV_8UC3, ImageData.data()), DeapthData, plan.dictionaries, plan.decimation, plan.regions);
+			ImageMutex.unlock();
+			return markers;
+		}
+
+		// robots, game pieces and anything else standing on the floor in the latest depth frame
+		std::vector<Blob> GetBlobs()
+		{
+			DeapthMutex.lock();
+			std::vector<uint16_t> depth(DeapthData.begin(), DeapthData.begin() + DeapthDataSize);
+			DeapthMutex.unlock();
+			return segmenter.Segment(depth);
+		}
+
+		DepthSegmenter &getSegmenter()
+		{
+			return segmenter;
+		}
+
+		// number of rgb frames received so far
+		uint64_t getImageFrameSequence()
+		{
+			ImageMutex.lock();
+			uint64_t sequence = ImageFrameSequence;
+			ImageMutex.unlock();
+			return sequence;
+		}
+
+		// when the latest rgb frame was received
+		std::chrono::steady_clock::time_point getImageFrameTime()
+		{
+			ImageMutex.lock();
+			std::chrono::steady_clock::time_point time = ImageFrameTime;
+			ImageMutex.unlock();
+			return time;
+		}
+
+		// when the latest depth frame was received
+		std::chrono::steady_clock::time_point getDepthFrameTime()
+		{
+			DeapthMutex.lock();
+			std::chrono::steady_clock::time_point time = DeapthFrameTime;
+			DeapthMutex.unlock();
+			return time;
+		}
+
+		// ms since the latest rgb frame was received
+		float getImageFrameAge()
+		{
+			ImageMutex.lock();
+			float age = ImageFrameSequence == 0 ? 0 : _millisecondsSince(ImageFrameTime);
+			ImageMutex.unlock();
+			return age;
+		}
 	};
 
+	void LogMarkers(TelemetryLog &log, uint64_t frame, const std::vector<Marker> &markers)
+	{
+		for (int i = 0; i < markers.size(); i++)
+		{
+			const Marker &marker = markers[i];
+			// fromCornerPoints keeps the detector order, so bottomLeft holds the bottom right corner
+			float corners[8] = {marker.topLeft.x, marker.topLeft.y, marker.topRight.x, marker.topRight.y, marker.bottomLeft.x, marker.bottomLeft.y, marker.bottomRight.x, marker.bottomRight.y};
+			uint16_t depth[5] = {(uint16_t)(marker.topLeft.z * 2048), (uint16_t)(marker.topRight.z * 2048), (uint16_t)(marker.bottomLeft.z * 2048), (uint16_t)(marker.bottomRight.z * 2048), (uint16_t)(marker.center.z * 2048)};
+			log.LogMarker(frame, marker.id, marker.dictionary, corners, depth);
+		}
+	}
+
 	static Kinect *GetDevice(int id)
 	{
 		static Freenect::Freenect freenect;
@@ -467,6 +882,17 @@ int window(0);
 // define libfreenect variables
 Freenect::Freenect freenect;
 FRC_Kinect::Kinect *device;
+FRC_Kinect::FrameScheduler scheduler({cv::aruco::DICT_4X4_250, cv::aruco::DICT_5X5_250, cv::aruco::DICT_6X6_250, cv::aruco::DICT_7X7_250});
+std::vector<FRC_Kinect::Marker> boxes;
+std::vector<FRC_Kinect::Blob> blobs;
+FRC_Kinect::DashboardStream *dashboard = nullptr;
+FRC_Kinect::TelemetryLog telemetry;
+uint64_t telemetryFrame = 0;
+// depth arrives on its own passes, frame records carry the cost of the latest depth frame
+float depthCost = 0;
+float segmentCost = 0;
+// skip the console status, printing every frame costs more than the rest of the loop on small boards
+bool quiet = false;
 double freenect_angle(0);
 freenect_video_format requested_format(FREENECT_VIDEO_RGB);
 
@@ -572,6 +998,10 @@ void keyPressed(unsigned char key, int x, int y)
 	{
 		device->setColorClipDistanceBack(device->getColorClipDistanceBack() - 0.01);
 	}
+	if (key == 'v' && dashboard)
+	{
+		dashboard->setView((FRC_Kinect::DashboardStream::View)((dashboard->getView() + 1) % 3));
+	}
 }
 
 void DrawCircle(float cx, float cy, float r, int num_segments, bool normalized = true, int width = 640, int height = 480)
@@ -644,36 +1074,85 @@ void DrawGLScene()
 	/*if(device->getState().m_code == TILT_STATUS_STOPPED){
 	  freenect_angle = device->getState().getTiltDegs();
 	}*/
+	std::chrono::steady_clock::time_point frameStart = std::chrono::steady_clock::now();
+	float stages[FRC_Kinect::Telemetry::StageCount] = {};
 	device->updateState();
-	printf("\r demanded tilt angle: %+4.2f device tilt angle: %+4.2f\n", freenect_angle, device->getState().getTiltDegs());
-	printf("\r color clip distance front: %+4.2f color clip distance back: %+4.2f\n", device->getColorClipDistanceFront(), device->getColorClipDistanceBack());
-	printf("\r applied clip distance front: %+4.2f applied clip distance back: %+4.2f\n", device->getColorClipDistanceFront_off() - device->getColorClipDistanceFront(), device->getColorClipDistanceBack_off() - device->getColorClipDistanceBack());
+	if (!quiet)
+	{
+		printf("\r demanded tilt angle: %+4.2f device tilt angle: %+4.2f\n", freenect_angle, device->getState().getTiltDegs());
+		printf("\r color clip distance front: %+4.2f color clip distance back: %+4.2f\n", device->getColorClipDistanceFront(), device->getColorClipDistanceBack());
+		printf("\r applied clip distance front: %+4.2f applied clip distance back: %+4.2f\n", device->getColorClipDistanceFront_off() - device->getColorClipDistanceFront(), device->getColorClipDistanceBack_off() - device->getColorClipDistanceBack());
+	}
 
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	glLoadIdentity();
 
 	glEnable(GL_TEXTURE_2D);
-	if (!device->getDepth(depth))
+	std::chrono::steady_clock::time_point stageStart = std::chrono::steady_clock::now();
+	bool newDepth = device->getDepth(depth);
+	if (!newDepth && !quiet)
 	{
 		printf("Missed depth frame\n");
 	}
+	if (newDepth)
+	{
+		depthCost = FRC_Kinect::_millisecondsSince(stageStart);
+		scheduler.RecordStage("depth", depthCost);
+	}
+	stages[FRC_Kinect::Telemetry::StageDepth] = depthCost;
 	glBindTexture(GL_TEXTURE_2D, gl_depth_tex);
 	glTexImage2D(GL_TEXTURE_2D, 0, 4, 640, 480, 0, GL_RGB, GL_UNSIGNED_BYTE, depth.data);
 
 	DrawBox(FRC_Kinect::boundingBox(glm::vec3(0, 0, 0), glm::vec3(640, 0, 0), glm::vec3(0, 480, 0), glm::vec3(640, 480, 0)), false);
 
-	if (device->getRGB(rgb))
+	// segment each new depth frame, shown as boxes over the depth view
+	if (newDepth)
+	{
+		stageStart = std::chrono::steady_clock::now();
+		blobs = device->GetBlobs();
+		segmentCost = FRC_Kinect::_millisecondsSince(stageStart);
+		scheduler.RecordStage("segment", segmentCost);
+	}
+	stages[FRC_Kinect::Telemetry::StageSegment] = segmentCost;
+	glDisable(GL_TEXTURE_2D);
+	glColor4f(1.0f, 1.0f, 0.0f, 0.3f);
+	for (int i = 0; i < blobs.size(); i++)
+	{
+		DrawBox(blobs[i]);
+	}
+	glColor3f(1.0f, 1.0f, 1.0f);
+	glEnable(GL_TEXTURE_2D);
+
+	stageStart = std::chrono::steady_clock::now();
+	bool newRgb = device->getRGB(rgb);
+	if (!newRgb && !quiet)
 	{
 		printf("Missed rgb frame\n");
 	}
 	glBindTexture(GL_TEXTURE_2D, gl_rgb_tex);
 	glTexImage2D(GL_TEXTURE_2D, 0, 4, 640, 480, 0, GL_RGB, GL_UNSIGNED_BYTE, rgb.data);
+	stages[FRC_Kinect::Telemetry::StageRgb] = FRC_Kinect::_millisecondsSince(stageStart);
 
 	DrawBox(FRC_Kinect::boundingBox(glm::vec3(640, 0, 0), glm::vec3(1280, 0, 0), glm::vec3(640, 480, 0), glm::vec3(1280, 480, 0)), false);
 
 	glDisable(GL_TEXTURE_2D);
-	// find apriltags
-	std::vector<FRC_Kinect::Marker> boxes = device->GetMarkers({cv::aruco::DICT_4X4_250, cv::aruco::DICT_5X5_250, cv::aruco::DICT_6X6_250, cv::aruco::DICT_7X7_250});
+	// find apriltags, stale frames keep the last markers
+	uint64_t frame = device->getImageFrameSequence();
+	FRC_Kinect::DetectionPlan plan = scheduler.Plan(frame, device->getImageFrameAge());
+	if (!plan.skip)
+	{
+		stageStart = std::chrono::steady_clock::now();
+		boxes = device->GetMarkers(plan);
+		stages[FRC_Kinect::Telemetry::StageDetect] = FRC_Kinect::_millisecondsSince(stageStart);
+		scheduler.RecordStage("detect", stages[FRC_Kinect::Telemetry::StageDetect]);
+		FRC_Kinect::LogMarkers(telemetry, frame, boxes);
+	}
+	stageStart = std::chrono::steady_clock::now();
+	if (!quiet)
+	{
+		printf("\r scheduler level: %d latency: %4.1fms budget: %4.1fms detect: %4.1fms\n", scheduler.getLevel(), scheduler.getLatency(), scheduler.getBudget(), scheduler.getStageCost("detect"));
+		printf("\r blobs: %zu segment: %4.1fms\n", blobs.size(), scheduler.getStageCost("segment"));
+	}
 	for (int i = 0; i < boxes.size(); i++)
 	{
 		// shift render position to right side
@@ -695,10 +1174,34 @@ void DrawGLScene()
 		glTranslatef(-640, 0, 0);
 	}
 	glColor3f(1.0f, 1.0f, 1.0f);
-	// set console cursor to 0,0
-	printf("\033[2J\033[1;1H");
-	fflush(stdout);
+	scheduler.Complete(boxes);
+	if (dashboard)
+	{
+		// rgb and depth stay empty on passes without a new frame
+		if (newRgb || newDepth)
+		{
+			dashboard->Publish(rgb, depth, boxes);
+		}
+		if (!quiet)
+		{
+			printf("\r dashboard view: %d bandwidth: %dkbps fps: %4.1f\n", dashboard->getView(), dashboard->getBandwidth(), dashboard->getFps());
+		}
+	}
+	if (!quiet)
+	{
+		// set console cursor to 0,0
+		printf("\033[2J\033[1;1H");
+		fflush(stdout);
+	}
 	glutSwapBuffers();
+	stages[FRC_Kinect::Telemetry::StageRender] = FRC_Kinect::_millisecondsSince(stageStart);
+	stages[FRC_Kinect::Telemetry::StageFrame] = FRC_Kinect::_millisecondsSince(frameStart);
+	// the idle loop redraws between camera frames, only log each frame once
+	if (frame != telemetryFrame)
+	{
+		telemetry.LogFrame(frame, FRC_Kinect::Telemetry::Timestamp(device->getImageFrameTime()), FRC_Kinect::Telemetry::Timestamp(device->getDepthFrameTime()), stages);
+		telemetryFrame = frame;
+	}
 }
 
 void InitGL()
@@ -727,6 +1230,8 @@ void InitGL()
 void displayKinectData(FRC_Kinect::Kinect *device)
 {
 	glutInit(&g_argc, g_argv);
+	// return from the main loop when the window closes so main can stop the device and flush the logs
+	glutSetOption(GLUT_ACTION_ON_WINDOW_CLOSE, GLUT_ACTION_GLUTMAINLOOP_RETURNS);
 	glutInitDisplayMode(GLUT_RGBA | GLUT_DOUBLE | GLUT_ALPHA | GLUT_DEPTH);
 	glutInitWindowSize(640 * 2, 480);
 	glutInitWindowPosition(0, 0);
@@ -737,9 +1242,172 @@ void displayKinectData(FRC_Kinect::Kinect *device)
 	InitGL();
 	glutMainLoop();
 }
+// run detection over a replay file without a sensor, reporting latency and accuracy against the file's ground truth
+// fails when fewer than minFound percent of the ground truth markers are detected,
+// or when floorHeight is set and segmentation doesn't put the floor that far below the camera
+int runReplay(std::string path, float minFound = 0, float floorHeight = 0)
+{
+	FRC_Kinect::ReplayReader reader;
+	if (!reader.Open(path))
+	{
+		printf("Could not open replay %s\n", path.c_str());
+		return -1;
+	}
+
+	std::vector<cv::aruco::PredefinedDictionaryType> dictionaries;
+	std::vector<float> times;
+	std::vector<float> segmentTimes;
+	int blobCount = 0;
+	FRC_Kinect::DepthSegmenter segmenter(reader.getWidth(), reader.getHeight());
+	// project depth with the camera the file was recorded or rendered with
+	FRC_Kinect::Replay::Intrinsics intrinsics = reader.getIntrinsics();
+	segmenter.setIntrinsics(intrinsics.fx, intrinsics.fy, intrinsics.cx, intrinsics.cy);
+	std::vector<float> floorDistances;
+	int truthCount = 0;
+	int hiddenCount = 0;
+	int found = 0;
+	double cornerError = 0;
+	FRC_Kinect::ReplayFrame frame;
+	cv::Mat image;
+	while (reader.ReadFrame(frame))
+	{
+		std::chrono::steady_clock::time_point start;
+		start = std::chrono::steady_clock::now();
+		blobCount += segmenter.Segment(frame.depth).size();
+		segmentTimes.push_back(FRC_Kinect::_millisecondsSince(start));
+		if (segmenter.hasFloorPlane())
+		{
+			floorDistances.push_back(segmenter.getFloorDistance());
+		}
+
+		// depth only frames from a --depth-log have nothing to detect on
+		if (frame.rgb.size() == 0)
+		{
+			continue;
+		}
+		if (frame.rgbEncoding == FRC_Kinect::Replay::Png)
+		{
+			cv::cvtColor(cv::imdecode(frame.rgb, cv::IMREAD_COLOR), image, cv::COLOR_BGR2RGB);
+		}
+		else
+		{
+			image = cv::Mat(reader.getHeight(), reader.getWidth(), CV_8UC3, frame.rgb.data());
+		}
+
+		// search the dictionaries the ground truth uses, or the ones the live view searches
+		if (dictionaries.size() == 0)
+		{
+			for (int i = 0; i < frame.truth.size(); i++)
+			{
+				if (std::find(dictionaries.begin(), dictionaries.end(), frame.truth[i].dictionary) == dictionaries.end())
+				{
+					dictionaries.push_back((cv::aruco::PredefinedDictionaryType)frame.truth[i].dictionary);
+				}
+			}
+		}
+		std::vector<cv::aruco::PredefinedDictionaryType> search = dictionaries;
+		if (search.size() == 0)
+		{
+			search = {cv::aruco::DICT_4X4_250, cv::aruco::DICT_5X5_250, cv::aruco::DICT_6X6_250, cv::aruco::DICT_7X7_250};
+		}
+
+		start = std::chrono::steady_clock::now();
+		std::vector<FRC_Kinect::Marker> markers = FRC_Kinect::findApriltags(image, frame.depth, search);
+		times.push_back(FRC_Kinect::_millisecondsSince(start));
+
+		for (int i = 0; i < frame.truth.size(); i++)
+		{
+			// markers that are cut off or covered by a nearer one can't be expected to be found
+			if (!(frame.truth[i].flags & FRC_Kinect::Replay::TruthVisible))
+			{
+				hiddenCount++;
+				continue;
+			}
+			truthCount++;
+			for (int j = 0; j < markers.size(); j++)
+			{
+				if (markers[j].id != frame.truth[i].id || markers[j].dictionary != frame.truth[i].dictionary)
+				{
+					continue;
+				}
+				glm::vec3 corners[4] = {markers[j].topLeft, markers[j].topRight, markers[j].bottomLeft, markers[j].bottomRight};
+				for (int k = 0; k < 4; k++)
+				{
+					cornerError += std::hypot(corners[k].x * image.cols - frame.truth[i].corners[k * 2], corners[k].y * image.rows - frame.truth[i].corners[k * 2 + 1]) / 4;
+				}
+				found++;
+				break;
+			}
+		}
+	}
+	if (segmentTimes.size() == 0)
+	{
+		printf("No frames in %s\n", path.c_str());
+		return -1;
+	}
+
+	if (times.size() > 0)
+	{
+		std::sort(times.begin(), times.end());
+		printf("%zu frames, detect p50 %.2fms p99 %.2fms max %.2fms\n", times.size(), times[times.size() / 2], times[times.size() * 99 / 100], times.back());
+	}
+	else
+	{
+		printf("%zu depth only frames\n", segmentTimes.size());
+	}
+	std::sort(segmentTimes.begin(), segmentTimes.end());
+	printf("segment p50 %.2fms p99 %.2fms, %.1f blobs per frame\n", segmentTimes[segmentTimes.size() / 2], segmentTimes[segmentTimes.size() * 99 / 100], (float)blobCount / segmentTimes.size());
+	if (truthCount > 0)
+	{
+		printf("found %d of %d visible markers (%.1f%%), %d hidden, mean corner error %.2fpx\n", found, truthCount, 100.0 * found / truthCount, hiddenCount, found ? cornerError / found : 0);
+		if (100.0 * found / truthCount < minFound)
+		{
+			return -1;
+		}
+	}
+	if (floorDistances.size() > 0)
+	{
+		std::sort(floorDistances.begin(), floorDistances.end());
+		printf("floor in %zu of %zu frames, %.3fm below the camera\n", floorDistances.size(), segmentTimes.size(), floorDistances[floorDistances.size() / 2]);
+	}
+	if (floorHeight > 0)
+	{
+		// the floor has to be found in nearly every frame and within 3cm, the wrong intrinsics put the synth floor about 5cm off
+		if (floorDistances.size() < segmentTimes.size() * 0.9 || std::abs(floorDistances[floorDistances.size() / 2] - floorHeight) > 0.03f)
+		{
+			printf("Floor does not match %.3fm\n", floorHeight);
+			return -1;
+		}
+	}
+	return 0;
+}
+
 // define main function
 int main(int argc, char **argv)
 {
+	// --replay <file> benchmarks detection on recorded or generated frames and exits, --min-found <percent> makes it a pass/fail check
+	// and --floor-height <meters> checks segmentation finds the floor that far below the camera
+	for (int i = 1; i + 1 < argc; i++)
+	{
+		if (std::string(argv[i]) == "--replay")
+		{
+			float minFound = 0;
+			float floorHeight = 0;
+			for (int j = 1; j + 1 < argc; j++)
+			{
+				if (std::string(argv[j]) == "--min-found")
+				{
+					minFound = atof(argv[j + 1]);
+				}
+				if (std::string(argv[j]) == "--floor-height")
+				{
+					floorHeight = atof(argv[j + 1]);
+				}
+			}
+			return runReplay(argv[i + 1], minFound, floorHeight);
+		}
+	}
+
 	//webhook test
 	// Get Kinect Device
 	device = &freenect.createDevice<FRC_Kinect::Kinect>(0);
@@ -752,6 +1420,82 @@ int main(int argc, char **argv)
 	colors.push_back(FRC_Kinect::Color(0xfdeff9));
 	device->setColors(colors);
 
+	// --depth-log <file> records every depth frame compressed as a depth only replay, play it back with --replay
+	FRC_Kinect::ReplayWriter depthLog;
+	bool logDepth = false;
+	// frames missing from the log after a failed write, the log stops at the first failure so it stays readable
+	uint64_t depthLogLost = 0;
+	for (int i = 1; i + 1 < argc; i++)
+	{
+		if (std::string(argv[i]) == "--depth-log")
+		{
+			logDepth = depthLog.Open(argv[i + 1], 640, 480);
+			if (!logDepth)
+			{
+				printf("Could not open depth log %s\n", argv[i + 1]);
+			}
+		}
+	}
+	// --telemetry <file> records frame timings and detections, --quiet drops the console status
+	for (int i = 1; i < argc; i++)
+	{
+		if (std::string(argv[i]) == "--telemetry" && i + 1 < argc && !telemetry.Open(argv[i + 1]))
+		{
+			printf("Could not open telemetry log %s\n", argv[i + 1]);
+		}
+		if (std::string(argv[i]) == "--quiet")
+		{
+			quiet = true;
+		}
+	}
+
+	// --stream-port <port> and --stream-kbps <kbps> serve the view to the driver station
+	int streamPort = 0;
+	int streamKbps = 1000;
+	for (int i = 1; i + 1 < argc; i++)
+	{
+		if (std::string(argv[i]) == "--stream-port")
+		{
+			streamPort = atoi(argv[i + 1]);
+		}
+		if (std::string(argv[i]) == "--stream-kbps")
+		{
+			streamKbps = atoi(argv[i + 1]);
+		}
+	}
+	if (streamPort > 0)
+	{
+		dashboard = new FRC_Kinect::DashboardStream(streamPort, streamKbps);
+		if (!dashboard->Start())
+		{
+			printf("Could not start dashboard stream on port %d\n", streamPort);
+			delete dashboard;
+			dashboard = nullptr;
+		}
+	}
+	if (logDepth)
+	{
+		device->enableDepthCompression([&depthLog, &depthLogLost](const std::vector<uint8_t> &depth, uint64_t sequence, uint64_t timestamp)
+									   {
+			if (depthLogLost > 0)
+			{
+				depthLogLost++;
+				return;
+			}
+			FRC_Kinect::ReplayFrame frame;
+			frame.sequence = sequence;
+			frame.timestamp = timestamp;
+			if (!depthLog.WriteFrame(frame, depth))
+			{
+				depthLogLost++;
+				fprintf(stderr, "depth log write failed at frame %" PRIu64 ", logging stopped\n", sequence);
+			} });
+	}
+
+	// report every adaptation the frame scheduler makes
+	scheduler.setDecisionCallback([](const FRC_Kinect::SchedulerDecision &decision)
+								  { fprintf(stderr, "frame %" PRIu64 ": %s (%s) level %d latency %4.1fms budget %4.1fms\n", decision.frame, decision.action.c_str(), decision.reason.c_str(), decision.level, decision.latency, decision.budget); });
+
 	// Start Kinect Device
 	device->setTiltDegrees(0);
 	device->startVideo();
@@ -762,6 +1506,14 @@ int main(int argc, char **argv)
 	// Stop Kinect Device
 	device->stopVideo();
 	device->stopDepth();
+	device->disableDepthCompression();
+	depthLog.Close();
+	if (logDepth && (depthLogLost > 0 || device->getDepthCompressionDropped() > 0))
+	{
+		printf("depth log is missing %" PRIu64 " frames after a write failure, %" PRIu64 " dropped by the encoder\n", depthLogLost, device->getDepthCompressionDropped());
+	}
+	telemetry.Close();
+	delete dashboard;
 	device->setLed(LED_OFF);
 	return 0;
 }
\ No newline at end of file
@@ -1,33 +1,594 @@
 #include <opencv2/opencv.hpp>
 #include <opencv2/aruco.hpp>
+#include <iostream>
+#include <fstream>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <cmath>
+
+#include "Replay.hpp"
+
+// kinect rgb camera, depth is assumed registered to it
+const double fx = 525;
+const double fy = 525;
+const double cx = 319.5;
+const double cy = 239.5;
+const int width = 640;
+const int height = 480;
+
+bool getDictionary(std::string name, cv::aruco::PredefinedDictionaryType &dictionary)
+{
+	if (name == "4" || name == "4x4")
+	{
+		dictionary = cv::aruco::DICT_4X4_50;
+	}
+	else if (name == "5" || name == "5x5")
+	{
+		dictionary = cv::aruco::DICT_5X5_50;
+	}
+	else if (name == "6" || name == "6x6")
+	{
+		dictionary = cv::aruco::DICT_6X6_50;
+	}
+	else if (name == "7" || name == "7x7")
+	{
+		dictionary = cv::aruco::DICT_7X7_50;
+	}
+	else if (name == "16h5")
+	{
+		dictionary = cv::aruco::DICT_APRILTAG_16h5;
+	}
+	else if (name == "25h9")
+	{
+		dictionary = cv::aruco::DICT_APRILTAG_25h9;
+	}
+	else if (name == "36h10")
+	{
+		dictionary = cv::aruco::DICT_APRILTAG_36h10;
+	}
+	else if (name == "36h11")
+	{
+		dictionary = cv::aruco::DICT_APRILTAG_36h11;
+	}
+	else
+	{
+		return false;
+	}
+	return true;
+}
+
+// meters to the kinect's raw 11 bit disparity, 2047 is no reading
+uint16_t depthToRaw(double z)
+{
+	double raw = (1.0 / z - 3.3309495161) / -0.0030711016;
+	if (z <= 0 || raw < 0 || raw >= 2047)
+	{
+		return 2047;
+	}
+	return (uint16_t)raw;
+}
+
+void rodrigues(const double r[3], double R[9])
+{
+	double theta = std::sqrt(r[0] * r[0] + r[1] * r[1] + r[2] * r[2]);
+	if (theta < 1e-12)
+	{
+		double identity[9] = {1, 0, 0, 0, 1, 0, 0, 0, 1};
+		std::copy(identity, identity + 9, R);
+		return;
+	}
+	double x = r[0] / theta, y = r[1] / theta, z = r[2] / theta;
+	double c = std::cos(theta), s = std::sin(theta), t = 1 - c;
+	double rotation[9] = {t * x * x + c, t * x * y - s * z, t * x * z + s * y,
+						  t * x * y + s * z, t * y * y + c, t * y * z - s * x,
+						  t * x * z - s * y, t * y * z + s * x, t * z * z + c};
+	std::copy(rotation, rotation + 9, R);
+}
+
+void multiply(const double A[9], const double B[9], double C[9])
+{
+	for (int i = 0; i < 3; i++)
+	{
+		for (int j = 0; j < 3; j++)
+		{
+			C[i * 3 + j] = A[i * 3] * B[j] + A[i * 3 + 1] * B[3 + j] + A[i * 3 + 2] * B[6 + j];
+		}
+	}
+}
+
+struct SynthSettings
+{
+	std::string output;
+	cv::aruco::PredefinedDictionaryType dictionary = cv::aruco::DICT_APRILTAG_36h11;
+	int frames = 300;
+	int markers = 4;
+	// black square edge, frc tags are 6.5in
+	double markerSize = 0.1651;
+	double minDistance = 0.8;
+	double maxDistance = 4;
+	// camera height over the floor
+	double floorHeight = 0.6;
+	unsigned int seed = 1;
+	int threads = std::thread::hardware_concurrency();
+	bool png = true;
+};
+
+// a marker drifting smoothly around a base pose so consecutive frames look like a real sequence
+struct SceneMarker
+{
+	int id;
+	cv::Mat image;
+	double base[6];
+	double amplitude[6];
+	double rate[6];
+	double phase[6];
+};
+
+struct MarkerPose
+{
+	const SceneMarker *marker;
+	double R[9];
+	double t[3];
+};
+
+MarkerPose poseAt(const SceneMarker &marker, int frame)
+{
+	MarkerPose pose;
+	pose.marker = &marker;
+	double p[6];
+	for (int i = 0; i < 6; i++)
+	{
+		p[i] = marker.base[i] + marker.amplitude[i] * std::sin(marker.phase[i] + marker.rate[i] * frame);
+	}
+	// flip about x so the marker faces the camera with its top up, then apply the drifting rotation
+	double flip[9] = {1, 0, 0, 0, -1, 0, 0, 0, -1};
+	double drift[9];
+	rodrigues(p, drift);
+	multiply(drift, flip, pose.R);
+	std::copy(p + 3, p + 6, pose.t);
+	return pose;
+}
+
+// pixel position of a point on the marker plane (marker frame, meters)
+cv::Point2f project(const MarkerPose &pose, double x, double y)
+{
+	double X = pose.R[0] * x + pose.R[1] * y + pose.t[0];
+	double Y = pose.R[3] * x + pose.R[4] * y + pose.t[1];
+	double Z = pose.R[6] * x + pose.R[7] * y + pose.t[2];
+	return cv::Point2f(fx * X / Z + cx, fy * Y / Z + cy);
+}
+
+// where the camera ray through pixel x, y meets the marker plane: depth z and marker plane coordinates u, v
+bool rayHit(const MarkerPose &pose, int x, int y, double &z, double &u, double &v)
+{
+	double normal[3] = {pose.R[2], pose.R[5], pose.R[8]};
+	double offset = normal[0] * pose.t[0] + normal[1] * pose.t[1] + normal[2] * pose.t[2];
+	double ray[3] = {(x - cx) / fx, (y - cy) / fy, 1};
+	double facing = normal[0] * ray[0] + normal[1] * ray[1] + normal[2] * ray[2];
+	if (std::abs(facing) < 1e-9)
+	{
+		return false;
+	}
+	z = offset / facing;
+	if (z <= 0)
+	{
+		return false;
+	}
+	double hit[3] = {ray[0] * z - pose.t[0], ray[1] * z - pose.t[1], z - pose.t[2]};
+	u = pose.R[0] * hit[0] + pose.R[3] * hit[1] + pose.R[6] * hit[2];
+	v = pose.R[1] * hit[0] + pose.R[4] * hit[1] + pose.R[7] * hit[2];
+	return true;
+}
+
+std::vector<SceneMarker> createScene(const SynthSettings &settings)
+{
+	std::mt19937 rng(settings.seed);
+	std::uniform_real_distribution<double> unit(0, 1);
+	cv::aruco::Dictionary dictionary = cv::aruco::getPredefinedDictionary(settings.dictionary);
+	int dictionarySize = dictionary.bytesList.rows;
+
+	std::vector<int> ids;
+	std::vector<SceneMarker> markers;
+	while (markers.size() < settings.markers && ids.size() < dictionarySize)
+	{
+		int id = rng() % dictionarySize;
+		if (std::find(ids.begin(), ids.end(), id) != ids.end())
+		{
+			continue;
+		}
+		ids.push_back(id);
+
+		SceneMarker marker;
+		marker.id = id;
+		// marker with a white quiet zone one bit wide, like a printed tag
+		int bits = dictionary.markerSize + 2;
+		int side = bits * 32;
+		cv::Mat code;
+		cv::aruco::generateImageMarker(dictionary, id, side, code, 1);
+		cv::Mat padded(side + 64, side + 64, CV_8UC1, cv::Scalar(255));
+		code.copyTo(padded(cv::Rect(32, 32, side, side)));
+		cv::cvtColor(padded, marker.image, cv::COLOR_GRAY2BGR);
+
+		double distance = settings.minDistance + (settings.maxDistance - settings.minDistance) * unit(rng);
+		// keep the marker inside the view at its distance
+		double spreadX = distance * (cx - 60) / fx;
+		double spreadY = distance * (cy - 60) / fy;
+		double base[6] = {(unit(rng) - 0.5) * 1.2, (unit(rng) - 0.5) * 1.2, (unit(rng) - 0.5) * 2, (unit(rng) - 0.5) * spreadX, (unit(rng) - 0.5) * spreadY, distance};
+		double amplitude[6] = {0.2, 0.2, 0.3, spreadX * 0.4, spreadY * 0.4, (settings.maxDistance - settings.minDistance) * 0.1};
+		for (int i = 0; i < 6; i++)
+		{
+			marker.base[i] = base[i];
+			marker.amplitude[i] = amplitude[i];
+			marker.rate[i] = 0.01 + 0.05 * unit(rng);
+			marker.phase[i] = 2 * M_PI * unit(rng);
+		}
+		markers.push_back(marker);
+	}
+	return markers;
+}
+
+FRC_Kinect::ReplayFrame renderFrame(const SynthSettings &settings, const std::vector<SceneMarker> &scene, int frame)
+{
+	// every frame has its own generator so frames come out the same however they are split over threads
+	std::mt19937 rng(settings.seed * 7919 + frame);
+	std::uniform_real_distribution<double> unit(0, 1);
+	std::normal_distribution<double> gaussian(0, 1);
+	double wall = settings.maxDistance + 1;
+
+	std::vector<MarkerPose> poses;
+	for (int i = 0; i < scene.size(); i++)
+	{
+		MarkerPose pose = poseAt(scene[i], frame);
+		// never let a marker slip behind the camera or the wall
+		pose.t[2] = std::min(std::max(pose.t[2], 0.4), wall - 0.5);
+		// or sink into the floor, the padded square reaches at most half a diagonal from its center
+		double reach = settings.markerSize / 2 * scene[i].image.cols / (scene[i].image.cols - 64) * std::sqrt(2.0);
+		pose.t[1] = std::min(pose.t[1], settings.floorHeight - reach);
+		poses.push_back(pose);
+	}
+	// draw far to near so nearer markers cover farther ones
+	std::sort(poses.begin(), poses.end(), [](const MarkerPose &a, const MarkerPose &b)
+			  { return a.t[2] > b.t[2]; });
+
+	// background: textured wall and a floor, with matching depth
+	cv::Mat image(height, width, CV_8UC3);
+	std::vector<double> depth(width * height);
+	double texture = unit(rng) * 10;
+	for (int y = 0; y < height; y++)
+	{
+		double dy = (y - cy) / fy;
+		double floorZ = dy > 0 ? settings.floorHeight / dy : wall;
+		for (int x = 0; x < width; x++)
+		{
+			cv::Vec3b &pixel = image.at<cv::Vec3b>(y, x);
+			if (floorZ < wall)
+			{
+				double X = (x - cx) / fx * floorZ;
+				int tile = ((int)std::floor(X * 2) + (int)std::floor(floorZ * 2)) & 1;
+				pixel = cv::Vec3b(90 + tile * 30, 90 + tile * 30, 95 + tile * 30);
+				depth[y * width + x] = floorZ;
+			}
+			else
+			{
+				double shade = 120 + 50 * std::sin(x * 0.013 + texture) * std::cos(y * 0.021 + texture);
+				pixel = cv::Vec3b(shade, shade * 0.9, shade * 0.8);
+				depth[y * width + x] = wall;
+			}
+		}
+	}
+
+	FRC_Kinect::ReplayFrame result;
+	result.sequence = frame;
+	result.timestamp = (uint64_t)frame * 33333333;
+	// which marker each pixel shows, -1 for the background
+	std::vector<int> owner(width * height, -1);
+	for (int i = 0; i < poses.size(); i++)
+	{
+		const MarkerPose &pose = poses[i];
+		const cv::Mat &markerImage = pose.marker->image;
+		// physical half size of the padded image
+		double half = settings.markerSize / 2 * markerImage.cols / (markerImage.cols - 64);
+
+		// depth of the marker plane where the padded square covers it and is nearer than what is already there,
+		// the rgb only shows the marker where the depth does
+		cv::Mat mask(height, width, CV_8UC1, cv::Scalar(0));
+		for (int y = 0; y < height; y++)
+		{
+			for (int x = 0; x < width; x++)
+			{
+				double z, u, v;
+				if (!rayHit(pose, x, y, z, u, v) || z >= depth[y * width + x])
+				{
+					continue;
+				}
+				if (std::abs(u) <= half && std::abs(v) <= half)
+				{
+					depth[y * width + x] = z;
+					owner[y * width + x] = i;
+					mask.at<uint8_t>(y, x) = 255;
+				}
+			}
+		}
+		std::vector<cv::Point2f> source = {cv::Point2f(0, 0), cv::Point2f(markerImage.cols, 0), cv::Point2f(markerImage.cols, markerImage.rows), cv::Point2f(0, markerImage.rows)};
+		std::vector<cv::Point2f> target = {project(pose, -half, half), project(pose, half, half), project(pose, half, -half), project(pose, -half, -half)};
+		cv::Mat warped;
+		cv::warpPerspective(markerImage, warped, cv::getPerspectiveTransform(source, target), image.size(), cv::INTER_LINEAR, cv::BORDER_REPLICATE);
+		warped.copyTo(image, mask);
+
+		double size = settings.markerSize / 2;
+		FRC_Kinect::Replay::TruthMarker truth = {};
+		truth.id = pose.marker->id;
+		truth.dictionary = settings.dictionary;
+		std::vector<cv::Point2f> corners = {project(pose, -size, size), project(pose, size, size), project(pose, size, -size), project(pose, -size, -size)};
+		for (int j = 0; j < 4; j++)
+		{
+			truth.corners[j * 2] = corners[j].x;
+			truth.corners[j * 2 + 1] = corners[j].y;
+		}
+		cv::Mat rotation(3, 3, CV_64FC1, (void *)pose.R), rvec;
+		cv::Rodrigues(rotation, rvec);
+		for (int j = 0; j < 3; j++)
+		{
+			truth.rotation[j] = rvec.at<double>(j);
+			truth.translation[j] = pose.t[j];
+		}
+		result.truth.push_back(truth);
+	}
+
+	// a marker counts as visible when it is all in the image and no nearer marker covers any of its black square
+	for (int i = 0; i < poses.size(); i++)
+	{
+		bool visible = true;
+		for (int j = 0; j < 4; j++)
+		{
+			float x = result.truth[i].corners[j * 2];
+			float y = result.truth[i].corners[j * 2 + 1];
+			visible = visible && x >= 0 && y >= 0 && x < width && y < height;
+		}
+		double size = settings.markerSize / 2;
+		for (int y = 0; y < height && visible; y++)
+		{
+			for (int x = 0; x < width; x++)
+			{
+				double z, u, v;
+				if (rayHit(poses[i], x, y, z, u, v) && std::abs(u) <= size && std::abs(v) <= size && owner[y * width + x] != i)
+				{
+					visible = false;
+					break;
+				}
+			}
+		}
+		result.truth[i].flags = visible ? FRC_Kinect::Replay::TruthVisible : 0;
+	}
+
+	// lighting: overall gain and offset with a sideways falloff
+	double gain = 0.6 + 0.7 * unit(rng);
+	double bias = (unit(rng) - 0.5) * 40;
+	double falloff = (unit(rng) - 0.5) * 0.6;
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			cv::Vec3b &pixel = image.at<cv::Vec3b>(y, x);
+			double light = gain * (1 + falloff * ((double)x / width - 0.5));
+			for (int c = 0; c < 3; c++)
+			{
+				pixel[c] = cv::saturate_cast<uint8_t>(pixel[c] * light + bias);
+			}
+		}
+	}
+	// focus blur and sensor noise
+	double blur = 1.2 * unit(rng);
+	if (blur > 0.3)
+	{
+		cv::GaussianBlur(image, image, cv::Size(0, 0), blur);
+	}
+	// cv::randn draws from the calling thread's generator, seed one per frame so the noise is the same on every run
+	cv::Mat noise(height, width, CV_32FC3);
+	cv::RNG noiseRng(settings.seed * 7919 + frame);
+	noiseRng.fill(noise, cv::RNG::NORMAL, cv::Scalar::all(0), cv::Scalar::all(2 + 6 * unit(rng)));
+	cv::Mat noisy;
+	image.convertTo(noisy, CV_32FC3);
+	noisy += noise;
+	noisy.convertTo(image, CV_8UC3);
+
+	// raw kinect depth with a little disparity noise and dropouts
+	result.depth.resize(width * height);
+	for (int i = 0; i < width * height; i++)
+	{
+		uint16_t raw = depthToRaw(depth[i]);
+		if (raw != 2047)
+		{
+			raw = std::min(2046, std::max(0, (int)std::lround(raw + gaussian(rng) * 0.5)));
+		}
+		result.depth[i] = unit(rng) < 0.005 ? 2047 : raw;
+	}
+
+	if (settings.png)
+	{
+		result.rgbEncoding = FRC_Kinect::Replay::Png;
+		cv::imencode(".png", image, result.rgb, {cv::IMWRITE_PNG_COMPRESSION, 1});
+	}
+	else
+	{
+		// kinect order is rgb
+		cv::Mat rgb;
+		cv::cvtColor(image, rgb, cv::COLOR_BGR2RGB);
+		result.rgbEncoding = FRC_Kinect::Replay::RawRgb;
+		result.rgb.assign(rgb.data, rgb.data + width * height * 3);
+	}
+	return result;
+}
+
+int synth(SynthSettings settings)
+{
+	FRC_Kinect::ReplayWriter writer;
+	FRC_Kinect::Replay::Intrinsics intrinsics;
+	intrinsics.fx = fx;
+	intrinsics.fy = fy;
+	intrinsics.cx = cx;
+	intrinsics.cy = cy;
+	if (!writer.Open(settings.output, width, height, intrinsics))
+	{
+		std::cout << "Could not open " << settings.output << std::endl;
+		return -1;
+	}
+	std::ofstream truth(settings.output + ".csv");
+	truth << "frame,id,dictionary,corner0_x,corner0_y,corner1_x,corner1_y,corner2_x,corner2_y,corner3_x,corner3_y,rvec_x,rvec_y,rvec_z,tvec_x,tvec_y,tvec_z,visible\n";
+
+	std::vector<SceneMarker> scene = createScene(settings);
+	// frames are spread over the threads, opencv's own threading would only fight them
+	cv::setNumThreads(1);
+	int threadcount = std::max(1, settings.threads);
+	int batch = threadcount * 8;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int first = 0; first < settings.frames; first += batch)
+	{
+		int count = std::min(batch, settings.frames - first);
+		std::vector<FRC_Kinect::ReplayFrame> frames(count);
+		std::atomic<int> next(0);
+		std::vector<std::thread> threads;
+		for (int i = 0; i < threadcount; i++)
+		{
+			threads.push_back(std::thread([&]()
+										  {
+				for (int j = next++; j < count; j = next++)
+				{
+					frames[j] = renderFrame(settings, scene, first + j);
+				} }));
+		}
+		for (int i = 0; i < threadcount; i++)
+		{
+			threads[i].join();
+		}
+
+		// depth is coded against the previous frame so frames are written in order
+		for (int i = 0; i < count; i++)
+		{
+			if (!writer.WriteFrame(frames[i]))
+			{
+				std::cout << "Could not write " << settings.output << std::endl;
+				return -1;
+			}
+			for (int j = 0; j < frames[i].truth.size(); j++)
+			{
+				const FRC_Kinect::Replay::TruthMarker &marker = frames[i].truth[j];
+				truth << frames[i].sequence << "," << marker.id << "," << marker.dictionary;
+				for (int k = 0; k < 8; k++)
+				{
+					truth << "," << marker.corners[k];
+				}
+				for (int k = 0; k < 3; k++)
+				{
+					truth << "," << marker.rotation[k];
+				}
+				for (int k = 0; k < 3; k++)
+				{
+					truth << "," << marker.translation[k];
+				}
+				truth << "," << (marker.flags & FRC_Kinect::Replay::TruthVisible ? 1 : 0) << "\n";
+			}
+		}
+	}
+	writer.Close();
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << settings.frames << " frames in " << seconds << "s (" << settings.frames / seconds << " fps)" << std::endl;
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 3)
+	{
+		std::cout << "usage: " << argv[0] << " <id> <dictionary> <output.png>" << std::endl;
+		std::cout << "       " << argv[0] << " synth <output.replay> [--frames n] [--dictionary 36h11] [--markers n] [--size meters]" << std::endl;
+		std::cout << "             [--min-distance meters] [--max-distance meters] [--seed n] [--threads n] [--raw]" << std::endl;
+		return -1;
+	}
+
+	if (std::string(argv[1]) == "synth")
+	{
+		SynthSettings settings;
+		settings.output = argv[2];
+		for (int i = 3; i < argc; i++)
+		{
+			std::string option = argv[i];
+			if (option == "--raw")
+			{
+				settings.png = false;
+				continue;
+			}
+			if (i + 1 >= argc)
+			{
+				std::cout << "Missing value for " << option << std::endl;
+				return -1;
+			}
+			std::string value = argv[++i];
+			if (option == "--frames")
+			{
+				settings.frames = atoi(value.c_str());
+			}
+			else if (option == "--dictionary")
+			{
+				if (!getDictionary(value, settings.dictionary))
+				{
+					std::cout << "Invalid dictionary " << value << std::endl;
+					return -1;
+				}
+			}
+			else if (option == "--markers")
+			{
+				settings.markers = atoi(value.c_str());
+			}
+			else if (option == "--size")
+			{
+				settings.markerSize = atof(value.c_str());
+			}
+			else if (option == "--min-distance")
+			{
+				settings.minDistance = atof(value.c_str());
+			}
+			else if (option == "--max-distance")
+			{
+				settings.maxDistance = atof(value.c_str());
+			}
+			else if (option == "--seed")
+			{
+				settings.seed = atoi(value.c_str());
+			}
+			else if (option == "--threads")
+			{
+				settings.threads = atoi(value.c_str());
+			}
+			else
+			{
+				std::cout << "Unknown option " << option << std::endl;
+				return -1;
+			}
+		}
+		return synth(settings);
+	}
+
+	if (argc < 4)
+	{
+		std::cout << "usage: " << argv[0] << " <id> <dictionary> <output.png>" << std::endl;
+		return -1;
+	}
 
-int main(int argc, char** argv) {
-	
 	//take int and marker format
 	int markerId = atoi(argv[1]);
-	int markerSize = atoi(argv[2]);
 	std::string markerName = argv[3];
 
 	cv::Mat markerImage;
-	cv::aruco::Dictionary dictionary;
-	switch (markerSize) {
-	case 4:
-		dictionary = cv::aruco::getPredefinedDictionary(cv::aruco::DICT_4X4_50);
-		break;
-	case 5:
-		dictionary = cv::aruco::getPredefinedDictionary(cv::aruco::DICT_5X5_50);
-		break;
-	case 6:
-		dictionary = cv::aruco::getPredefinedDictionary(cv::aruco::DICT_6X6_50);
-		break;
-	case 7:
-		dictionary = cv::aruco::getPredefinedDictionary(cv::aruco::DICT_7X7_50);
-		break;
-	default:
+	cv::aruco::PredefinedDictionaryType dictionaryType;
+	if (!getDictionary(argv[2], dictionaryType))
+	{
 		std::cout << "Invalid marker size" << std::endl;
 		return -1;
 	}
+	cv::aruco::Dictionary dictionary = cv::aruco::getPredefinedDictionary(dictionaryType);
 	cv::aruco::generateImageMarker(dictionary, markerId, 200, markerImage, 1);
 	cv::imwrite(markerName, markerImage);
 	return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,80 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+
+#include "Telemetry.hpp"
+
+int main(int argc, char **argv)
+{
+	// take telemetry log and the csv files to write
+	if (argc < 4)
+	{
+		std::cout << "usage: " << argv[0] << " <telemetry log> <frames csv> <markers csv>" << std::endl;
+		return -1;
+	}
+
+	std::ifstream log(argv[1], std::ios::binary);
+	FRC_Kinect::Telemetry::Header header;
+	if (!log.read((char *)&header, sizeof(header)) || std::string(header.magic, 4) != "FKTL")
+	{
+		std::cout << "Not a telemetry log" << std::endl;
+		return -1;
+	}
+	if (header.version != FRC_Kinect::Telemetry::Version || header.recordSize != sizeof(FRC_Kinect::Telemetry::Record))
+	{
+		std::cout << "Unsupported telemetry version " << header.version << std::endl;
+		return -1;
+	}
+	if (header.stageCount > FRC_Kinect::Telemetry::StageCapacity)
+	{
+		std::cout << "Damaged telemetry log, " << header.stageCount << " stages" << std::endl;
+		return -1;
+	}
+
+	std::ofstream frames(argv[2]);
+	frames << "frame,rgb_capture_ns,depth_capture_ns";
+	for (int i = 0; i < header.stageCount; i++)
+	{
+		frames << "," << FRC_Kinect::Telemetry::StageName(i) << "_ms";
+	}
+	frames << "\n";
+
+	std::ofstream markers(argv[3]);
+	markers << "frame,id,dictionary,top_left_x,top_left_y,top_right_x,top_right_y,bottom_right_x,bottom_right_y,bottom_left_x,bottom_left_y,"
+			<< "top_left_depth,top_right_depth,bottom_right_depth,bottom_left_depth,center_depth\n";
+
+	// a log from a crashed run still holds every flushed record even though the file was never trimmed
+	uint64_t frameCount = 0;
+	uint64_t markerCount = 0;
+	FRC_Kinect::Telemetry::Record record;
+	for (uint64_t i = 0; i < header.recordCount && log.read((char *)&record, sizeof(record)); i++)
+	{
+		if (record.type == FRC_Kinect::Telemetry::FrameRecord)
+		{
+			frames << record.frame << "," << record.timing.rgbCapture << "," << record.timing.depthCapture;
+			for (int j = 0; j < header.stageCount; j++)
+			{
+				frames << "," << record.timing.stages[j];
+			}
+			frames << "\n";
+			frameCount++;
+		}
+		else if (record.type == FRC_Kinect::Telemetry::MarkerRecord)
+		{
+			markers << record.frame << "," << record.marker.id << "," << record.marker.dictionary;
+			for (int j = 0; j < 8; j++)
+			{
+				markers << "," << record.marker.corners[j];
+			}
+			for (int j = 0; j < 5; j++)
+			{
+				markers << "," << record.marker.depth[j];
+			}
+			markers << "\n";
+			markerCount++;
+		}
+	}
+
+	std::cout << frameCount << " frames, " << markerCount << " markers, " << header.dropped << " dropped" << std::endl;
+	return 0;
+}
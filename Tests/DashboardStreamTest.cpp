@@ -0,0 +1,174 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "DashboardStream.hpp"
+
+// drives the dashboard stream over localhost like the driver station would
+int failures = 0;
+
+void check(bool passed, std::string what)
+{
+	if (!passed)
+	{
+		std::cout << "FAIL: " << what << std::endl;
+		failures++;
+	}
+}
+
+int connectTo(int port)
+{
+	int client = socket(AF_INET, SOCK_STREAM, 0);
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = htons(port);
+	if (client < 0 || connect(client, (sockaddr *)&address, sizeof(address)) < 0)
+	{
+		close(client);
+		return -1;
+	}
+	return client;
+}
+
+// reads until the server closes the connection or seconds pass
+std::string request(int port, std::string path, float seconds = 2)
+{
+	int client = connectTo(port);
+	if (client < 0)
+	{
+		return "";
+	}
+	std::string text = "GET " + path + " HTTP/1.0\r\n\r\n";
+	send(client, text.data(), text.size(), MSG_NOSIGNAL);
+	std::string response;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	while (FRC_Kinect::_millisecondsSince(start) < seconds * 1000)
+	{
+		pollfd readable = {client, POLLIN, 0};
+		if (poll(&readable, 1, 50) <= 0)
+		{
+			continue;
+		}
+		char buffer[65536];
+		ssize_t received = recv(client, buffer, sizeof(buffer), 0);
+		if (received <= 0)
+		{
+			break;
+		}
+		response.append(buffer, received);
+	}
+	close(client);
+	return response;
+}
+
+std::string body(const std::string &response)
+{
+	size_t end = response.find("\r\n\r\n");
+	return end == std::string::npos ? "" : response.substr(end + 4);
+}
+
+// a gradient with fine noise, so frames neither vanish nor dwarf the budget
+cv::Mat testFrame(int frame)
+{
+	cv::Mat image(480, 640, CV_8UC3);
+	cv::RNG rng(frame);
+	rng.fill(image, cv::RNG::UNIFORM, cv::Scalar::all(0), cv::Scalar::all(24));
+	for (int y = 0; y < image.rows; y++)
+	{
+		for (int x = 0; x < image.cols; x++)
+		{
+			cv::Vec3b &pixel = image.at<cv::Vec3b>(y, x);
+			pixel[0] += (x + frame) % 200;
+			pixel[1] += y % 200;
+			pixel[2] += 100;
+		}
+	}
+	return image;
+}
+
+int main()
+{
+	const int kbps = 2000;
+	FRC_Kinect::DashboardStream stream(0, kbps);
+	check(stream.Start(), "start on a free port");
+	int port = stream.getPort();
+	check(port > 0, "bound port");
+
+	check(request(port, "/snapshot.jpg").rfind("HTTP/1.0 503", 0) == 0, "snapshot before any frame is unavailable");
+	check(request(port, "/missing").rfind("HTTP/1.0 404", 0) == 0, "unknown path is not found");
+
+	// publish at camera rate for the rest of the test
+	std::atomic<bool> publishing{true};
+	std::thread publisher([&]()
+						  {
+		std::vector<FRC_Kinect::Marker> markers = {FRC_Kinect::Marker(glm::vec3(0.4f, 0.4f, 0), glm::vec3(0.6f, 0.4f, 0), glm::vec3(0.6f, 0.6f, 0), glm::vec3(0.4f, 0.6f, 0), 7)};
+		std::vector<cv::Mat> frames;
+		for (int i = 0; i < 8; i++)
+		{
+			frames.push_back(testFrame(i));
+		}
+		for (int i = 0; publishing; i++)
+		{
+			stream.Publish(frames[i % frames.size()], cv::Mat(), markers);
+			std::this_thread::sleep_for(std::chrono::milliseconds(33));
+		} });
+
+	// the idle trickle encodes about one frame a second
+	std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+	std::string snapshot = request(port, "/snapshot.jpg");
+	std::string jpeg = body(snapshot);
+	check(snapshot.rfind("HTTP/1.0 200", 0) == 0, "snapshot is served");
+	check(snapshot.find("Content-Type: image/jpeg") != std::string::npos, "snapshot content type");
+	check(snapshot.find("Content-Length: " + std::to_string(jpeg.size()) + "\r\n") != std::string::npos, "snapshot length matches its body");
+	check(jpeg.size() > 2 && (uint8_t)jpeg[0] == 0xFF && (uint8_t)jpeg[1] == 0xD8, "snapshot is a jpeg");
+
+	// two viewers share the link cap, together they must stay under it
+	float seconds = 4;
+	uint64_t sentBefore = stream.getBytesSent();
+	std::string viewers[2];
+	std::thread first([&]()
+					  { viewers[0] = request(port, "/stream.mjpg", seconds); });
+	std::thread second([&]()
+					   { viewers[1] = request(port, "/stream.mjpg?view=overlay", seconds); });
+	first.join();
+	second.join();
+	uint64_t sent = stream.getBytesSent() - sentBefore;
+
+	size_t received = 0;
+	for (int i = 0; i < 2; i++)
+	{
+		std::string name = "viewer " + std::to_string(i) + " ";
+		check(viewers[i].rfind("HTTP/1.0 200", 0) == 0, name + "stream is served");
+		check(viewers[i].find("multipart/x-mixed-replace; boundary=frame") != std::string::npos, name + "multipart stream");
+		check(viewers[i].find("--frame\r\nContent-Type: image/jpeg") != std::string::npos, name + "receives frames");
+		received += body(viewers[i]).size();
+	}
+	// a quarter second burst plus the frame that overdraws the bucket for each viewer
+	float budget = kbps * 1000 / 8.0f * (seconds + 0.25f) + 2 * jpeg.size();
+	check(sent <= budget, "sent " + std::to_string(sent) + " bytes against a budget of " + std::to_string((size_t)budget));
+	check(received <= sent, "viewers received what was sent");
+	// the demand is far over the cap, so the stream should use most of it rather than stall
+	check(sent >= budget / 4, "stream keeps sending, " + std::to_string(sent) + " bytes");
+
+	publishing = false;
+	publisher.join();
+	stream.Stop();
+
+	if (failures > 0)
+	{
+		return -1;
+	}
+	std::cout << "dashboard stream ok, " << sent << " bytes in " << seconds << "s" << std::endl;
+	return 0;
+}
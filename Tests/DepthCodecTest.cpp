@@ -0,0 +1,156 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <random>
+#include <cmath>
+#include <cstdint>
+
+#include "DepthCodec.hpp"
+
+// round trips through the depth codec, every frame has to come back bit exact
+int failures = 0;
+
+void check(bool passed, std::string what)
+{
+	if (!passed)
+	{
+		std::cout << "FAIL: " << what << std::endl;
+		failures++;
+	}
+}
+
+uint16_t toRaw(float z)
+{
+	float raw = (1.0f / z - 3.3309495161f) / -0.0030711016f;
+	if (raw < 0 || raw >= 2047)
+	{
+		return 2047;
+	}
+	return (uint16_t)raw;
+}
+
+// floor, a wall and a box that moves with frame, with sensor noise and the shadow the kinect leaves left of near objects
+std::vector<uint16_t> renderScene(int width, int height, int frame, std::mt19937 &rng)
+{
+	std::normal_distribution<float> noise(0, 0.5f);
+	float focal = 525 * width / 640.0f;
+	float cx = (width - 1) / 2.0f;
+	float cy = (height - 1) / 2.0f;
+	float boxLeft = -0.6f + frame * 0.01f;
+	float boxRight = boxLeft + 0.4f;
+	std::vector<uint16_t> depth(width * height);
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			float rayX = (x - cx) / focal;
+			float rayY = (y - cy) / focal;
+			float z = rayY > 0 ? std::min(0.6f / rayY, 4.0f) : 4.0f;
+			bool shadow = false;
+			if (rayY * 2 > 0.2f && rayY * 2 < 0.6f)
+			{
+				if (rayX * 2 > boxLeft && rayX * 2 < boxRight)
+				{
+					z = 2;
+				}
+				else if (rayX * 2 > boxLeft - 0.05f && rayX * 2 <= boxLeft)
+				{
+					shadow = true;
+				}
+			}
+			uint16_t raw = toRaw(z);
+			if (raw != 2047)
+			{
+				raw = std::max(0, std::min(2046, (int)std::lround(raw + noise(rng))));
+			}
+			depth[y * width + x] = shadow ? 2047 : raw;
+		}
+	}
+	return depth;
+}
+
+// encodes frames in order and decodes them back, returns the total coded size
+size_t roundTrip(const std::vector<std::vector<uint16_t>> &frames, int width, int height, std::string name)
+{
+	FRC_Kinect::DepthEncoder encoder(width, height);
+	FRC_Kinect::DepthDecoder decoder;
+	size_t size = 0;
+	for (int i = 0; i < frames.size(); i++)
+	{
+		std::vector<uint8_t> data = encoder.Encode(frames[i]);
+		size += data.size();
+		check(((data[5] & FRC_Kinect::DepthCodec::KeyframeFlag) != 0) == (i == 0), name + " frame " + std::to_string(i) + " keyframe flag");
+		std::vector<uint16_t> depth;
+		int decodedWidth = 0;
+		int decodedHeight = 0;
+		check(decoder.Decode(data, depth, &decodedWidth, &decodedHeight), name + " frame " + std::to_string(i) + " decodes");
+		check(decodedWidth == width && decodedHeight == height, name + " frame " + std::to_string(i) + " size");
+		check(depth == frames[i], name + " frame " + std::to_string(i) + " lossless");
+	}
+	return size;
+}
+
+int main()
+{
+	std::mt19937 rng(5);
+
+	// keyframe then inter frames, the representative frame has to pack at least 4x
+	std::vector<std::vector<uint16_t>> frames;
+	for (int i = 0; i < 5; i++)
+	{
+		frames.push_back(renderScene(640, 480, i, rng));
+	}
+	roundTrip(frames, 640, 480, "scene");
+	FRC_Kinect::DepthEncoder encoder;
+	float ratio = 640 * 480 * 2.0f / encoder.Encode(frames[0]).size();
+	check(ratio >= 4, "keyframe ratio " + std::to_string(ratio));
+
+	// values over 11 bits force raw bands
+	std::vector<std::vector<uint16_t>> wide = {frames[0], frames[1]};
+	wide[0][1000] = 0xFFFF;
+	wide[1][640 * 300 + 5] = 4096;
+	roundTrip(wide, 640, 480, "raw");
+
+	// width not a multiple of the block size, height not a multiple of the band
+	std::vector<std::vector<uint16_t>> odd;
+	for (int i = 0; i < 3; i++)
+	{
+		odd.push_back(renderScene(37, 23, i, rng));
+	}
+	roundTrip(odd, 37, 23, "odd");
+	std::vector<std::vector<uint16_t>> column = {renderScene(1, 40, 0, rng), renderScene(1, 40, 1, rng)};
+	roundTrip(column, 1, 40, "column");
+
+	// damaged streams have to be rejected, not decoded into garbage
+	FRC_Kinect::DepthEncoder damagedEncoder;
+	std::vector<uint8_t> keyframe = damagedEncoder.Encode(frames[0]);
+	std::vector<uint8_t> inter = damagedEncoder.Encode(frames[1]);
+	std::vector<uint16_t> depth;
+	for (size_t length : {(size_t)0, (size_t)10, (size_t)100, keyframe.size() / 2, keyframe.size() - 1})
+	{
+		FRC_Kinect::DepthDecoder decoder;
+		check(!decoder.Decode(keyframe.data(), length, depth), "truncated to " + std::to_string(length));
+	}
+	std::vector<uint8_t> badMode = keyframe;
+	badMode[FRC_Kinect::DepthCodec::HeaderSize + 30 * 4] = 7;
+	std::vector<uint8_t> badWidth = keyframe;
+	badWidth[FRC_Kinect::DepthCodec::HeaderSize + 30 * 4 + 1] = 15;
+	std::vector<uint8_t> badBands = keyframe;
+	badBands[12] = 3;
+	std::vector<uint8_t> badMagic = keyframe;
+	badMagic[0] = 'X';
+	for (const std::vector<uint8_t> &bad : {badMode, badWidth, badBands, badMagic})
+	{
+		FRC_Kinect::DepthDecoder decoder;
+		check(!decoder.Decode(bad, depth), "corrupt frame");
+	}
+	FRC_Kinect::DepthDecoder missingReference;
+	check(!missingReference.Decode(inter, depth), "inter frame without its keyframe");
+
+	if (failures > 0)
+	{
+		return -1;
+	}
+	std::cout << "depth codec ok, keyframe " << ratio << "x" << std::endl;
+	return 0;
+}
@@ -0,0 +1,122 @@
+#include <iostream>
+#include <vector>
+#include <random>
+#include <cmath>
+#include <cstdint>
+#include <string>
+
+#include "DepthSegmenter.hpp"
+
+// synthetic kinect view of a flat floor with two boxes standing on it, checked against the known geometry
+const int width = 640;
+const int height = 480;
+const float focal = 525;
+const float cameraHeight = 0.6f;
+
+int failures = 0;
+
+void check(bool passed, std::string what)
+{
+	if (!passed)
+	{
+		std::cout << "FAIL: " << what << std::endl;
+		failures++;
+	}
+}
+
+bool near(float value, float expected, float tolerance)
+{
+	return std::abs(value - expected) <= tolerance;
+}
+
+// inverse of the kinect disparity to meters fit the segmenter uses
+uint16_t toRaw(float z)
+{
+	float raw = (1.0f / z - 3.3309495161f) / -0.0030711016f;
+	if (raw < 0 || raw >= 2047)
+	{
+		return 2047;
+	}
+	return (uint16_t)raw;
+}
+
+struct Box
+{
+	// meters in the depth camera frame, the front face of the box at z
+	float left, right, top, bottom, z;
+};
+
+std::vector<uint16_t> renderScene(const std::vector<Box> &boxes, std::mt19937 &rng)
+{
+	std::normal_distribution<float> noise(0, 0.5f);
+	float cx = (width - 1) / 2.0f;
+	float cy = (height - 1) / 2.0f;
+	std::vector<uint16_t> depth(width * height);
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			// rays below the horizon hit the floor, the rest see a wall 5m out
+			float rayX = (x - cx) / focal;
+			float rayY = (y - cy) / focal;
+			float z = rayY > 0 ? std::min(cameraHeight / rayY, 5.0f) : 5.0f;
+			for (int i = 0; i < boxes.size(); i++)
+			{
+				const Box &box = boxes[i];
+				if (box.z < z && rayX * box.z > box.left && rayX * box.z < box.right && rayY * box.z > box.top && rayY * box.z < box.bottom)
+				{
+					z = box.z;
+				}
+			}
+			uint16_t raw = toRaw(z);
+			if (raw != 2047)
+			{
+				raw = std::max(0, std::min(2046, (int)std::lround(raw + noise(rng))));
+			}
+			depth[y * width + x] = raw;
+		}
+	}
+	return depth;
+}
+
+int main()
+{
+	std::vector<Box> boxes = {{-0.6f, -0.2f, 0.2f, cameraHeight, 2.0f}, {0.3f, 0.8f, 0.3f, cameraHeight, 3.0f}};
+
+	FRC_Kinect::DepthSegmenter segmenter(width, height);
+	segmenter.setIntrinsics(focal, focal, (width - 1) / 2.0f, (height - 1) / 2.0f);
+	std::mt19937 rng(3);
+	std::vector<FRC_Kinect::Blob> blobs;
+	// a few frames so the floor tracking settles
+	for (int frame = 0; frame < 10; frame++)
+	{
+		blobs = segmenter.Segment(renderScene(boxes, rng));
+	}
+
+	check(segmenter.hasFloorPlane(), "floor found");
+	check(near(segmenter.getFloorDistance(), cameraHeight, 0.02f), "floor height " + std::to_string(segmenter.getFloorDistance()));
+	check(near(segmenter.getFloorNormal().y, -1, 0.01f), "floor normal points up");
+	check(blobs.size() == boxes.size(), "blob count " + std::to_string(blobs.size()));
+
+	// blobs come largest first, the same order as the boxes
+	for (int i = 0; i < blobs.size() && i < boxes.size(); i++)
+	{
+		const Box &box = boxes[i];
+		const FRC_Kinect::Blob &blob = blobs[i];
+		std::string name = "blob " + std::to_string(i) + " ";
+		check(near(blob.minimum.x, box.left, 0.03f) && near(blob.maximum.x, box.right, 0.03f), name + "x extent");
+		// the bottom of the box within the floor threshold counts as floor
+		check(near(blob.minimum.y, box.top, 0.03f) && near(blob.maximum.y, box.bottom, 0.06f), name + "y extent");
+		check(near(blob.centroid.z, box.z, 0.05f), name + "depth " + std::to_string(blob.centroid.z));
+
+		float expected = (box.right - box.left) * focal / box.z * (box.bottom - box.top - 0.04f) * focal / box.z;
+		check(near(blob.pixelCount, expected, expected * 0.1f), name + "pixels " + std::to_string(blob.pixelCount) + " expected " + std::to_string((int)expected));
+	}
+
+	if (failures > 0)
+	{
+		return -1;
+	}
+	std::cout << "segmenter ok" << std::endl;
+	return 0;
+}